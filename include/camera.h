@@ -0,0 +1,18 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include "utils.h"
+
+struct Camera {
+    Vec3 position;
+    float yaw;   // Radians around the world Y axis
+    float pitch; // Radians around the camera X axis
+
+    // Fills a column-major matrix for u_rotationMatrix. The shader multiplies it from the left
+    // (vec * matrix), so the camera-to-world rotation is stored transposed.
+    void getRotationMatrix(float out[16]) const;
+};
+
+Camera createDefaultCamera();
+
+#endif
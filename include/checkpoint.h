@@ -0,0 +1,65 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "renderer.h"
+#include <string>
+
+// Keeps the state of a progressive render in a memory-mapped file, so a killed or preempted job can
+// pick up where it left off. The file has a header and two image slots. A checkpoint copies the
+// accumulation target on the GPU, then step() reads it back a band of rows at a time, between passes,
+// straight into the slot the header doesn't point to, and the header is only switched over once the
+// slot is complete. Rendering never waits for a whole-frame readback, and a crash at any moment leaves
+// the previous checkpoint intact.
+//
+// The shader's random numbers are a hash of the pixel, the sample seed and u_time = passes * framePasses,
+// so together with the scene hash (which covers framePasses) and the seed the pass count is the complete
+// RNG state.
+class Checkpoint {
+public:
+    Checkpoint(const std::string& path, int width, int height, AccumulationMode accumulation, unsigned long long sceneHash, int seed);
+    ~Checkpoint();
+
+    // Maps the file, creating it if needed. With resume the file must exist and match the render.
+    bool open(bool resume);
+
+    // Loads the last complete checkpoint into the renderer. Returns false if there is none.
+    bool restore(Renderer& renderer);
+
+    // Starts a checkpoint of the renderer's current state, unless one is still being written
+    void begin(Renderer& renderer);
+    // Writes the next band of an in-flight checkpoint, meant to be called after every pass
+    void step(Renderer& renderer);
+    bool busy() const { return m_nextRow >= 0; }
+
+    // Writes a complete checkpoint right away, e.g. when the job is stopped
+    void save(Renderer& renderer);
+
+    int passes() const;
+
+private:
+    Checkpoint(const Checkpoint&);
+    Checkpoint& operator=(const Checkpoint&);
+
+    struct Header;
+
+    Header* header() const { return (Header*)m_mapped; }
+    float* slot(int index) const;
+    void finishSlot();
+
+    std::string m_path;
+    int m_width;
+    int m_height;
+    AccumulationMode m_accumulation;
+    unsigned long long m_sceneHash;
+    int m_seed;
+
+    int m_fd;
+    unsigned char* m_mapped;
+    size_t m_size;
+
+    int m_writeSlot;
+    int m_snapshotPasses;
+    int m_nextRow; // Next row of the in-flight checkpoint to read back, -1 if none
+};
+
+#endif
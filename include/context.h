@@ -0,0 +1,38 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <string>
+
+// An OpenGL core context without a window or display server, for batch rendering on render nodes.
+// Tries an EGL surfaceless context, then an EGL pbuffer, then (when built with -DRAYTRACER_OSMESA)
+// OSMesa. All of them work on CPU-only machines through Mesa's llvmpipe. Rendering goes to FBOs.
+class HeadlessContext {
+public:
+    HeadlessContext();
+    ~HeadlessContext();
+
+    bool create(int major, int minor);
+
+    // Name of the API that provided the context, for logs
+    const std::string& description() const { return m_description; }
+
+    // Loader for gladLoadGLLoader, valid once create() succeeded
+    static void* getProcAddress(const char* name);
+
+private:
+    HeadlessContext(const HeadlessContext&);
+    HeadlessContext& operator=(const HeadlessContext&);
+
+    bool createEGL(int major, int minor, bool surfaceless);
+    bool createOSMesa(int major, int minor);
+    void destroy();
+
+    void* m_display;
+    void* m_context;
+    void* m_surface;
+    void* m_osmesaContext;
+    unsigned char* m_osmesaBuffer;
+    std::string m_description;
+};
+
+#endif
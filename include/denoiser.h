@@ -0,0 +1,55 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+
+#include "threadpool.h"
+#include <vector>
+
+struct DenoiseSettings {
+    int iterations;    // Filter levels, each one doubles the tap spacing: 4 reach 30 pixels out
+    float colorSigma;  // Edge stopping on tone-compressed radiance, halved every level
+    float normalSigma; // Edge stopping on the distance between world normals
+    float depthSigma;  // Edge stopping on depth differences, relative to the pixel's depth and the tap spacing
+    float albedoSigma; // Edge stopping on albedo differences
+};
+
+DenoiseSettings defaultDenoiseSettings();
+
+// How far a denoised pixel depends on the input in every direction: each level reaches two taps out
+int denoiseReach(const DenoiseSettings& settings);
+
+// Edge-avoiding à-trous wavelet filter (Dammertz et al. 2010) for final frames, on the CPU. Every level
+// is a 5x5 B3-spline blur whose taps are 2^level pixels apart, weighted down where radiance, normal,
+// depth or albedo differ from the center pixel, so edges and texture survive while noise averages out.
+// Radiance is divided by the albedo before filtering and multiplied back after it, so the filter only
+// has to smooth lighting. Rows are split over the thread pool, 4 pixels at a time with SSE.
+class Denoiser {
+public:
+    Denoiser(int width, int height, ThreadPool& pool);
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+
+    // Fills rows [rowBegin, rowBegin + rowCount), counted from the top, with RGBA floats: radiance and the
+    // FEATURE_ALBEDO and FEATURE_NORMAL_DEPTH buffers of the renderer
+    void setRows(int rowBegin, int rowCount, const float* color, const float* albedo, const float* normalDepth);
+    void denoise(const DenoiseSettings& settings);
+    // Writes the rgb of the denoised rows, alpha is left as it is
+    void getRows(int rowBegin, int rowCount, float* rgba) const;
+
+private:
+    void filterRows(int rowBegin, int rowEnd, int step, const DenoiseSettings& settings, float colorScale);
+
+    int m_width;
+    int m_height;
+    ThreadPool& m_pool;
+
+    // One plane per channel, so 4 neighbouring pixels load as one SSE vector
+    std::vector<float> m_color[3];  // Radiance divided by albedo
+    std::vector<float> m_filtered[3];
+    std::vector<float> m_guide[3];  // m_color compressed to [0, 1), for edge stopping
+    std::vector<float> m_normal[3];
+    std::vector<float> m_depth;
+    std::vector<float> m_albedo[3];
+};
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "image.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+// What every worker needs to render its share of a bucketed image. The scene travels as the text
+// of its scene file, so workers don't need access to the coordinator's files.
+struct TileJob {
+    int width;
+    int height;
+    int bucketSize;
+    int targetPasses;
+    int seed; // Renderer::setSampleSeed()
+    int denoise; // 1 if workers denoise their buckets, see --denoise
+    std::string sceneText;
+};
+
+// Renders bucket `index` (row-major from the top left) of the job into rgba, top row first, with the
+// sample counts in alpha, and returns its size through width/height
+typedef std::function<bool(int index, std::vector<float>& rgba, int& width, int& height)> TileRenderFunction;
+// Prepares a worker for a job, e.g. loads the scene and creates the renderer
+typedef std::function<bool(const TileJob& job)> TileJobFunction;
+
+// Hands the buckets of a job to workers connecting on a TCP port and writes the results as they
+// arrive. Tiles of workers that disconnect are handed out again. Once no tile is left to hand out,
+// idle workers also get copies of tiles that are overdue, i.e. out for longer than tileTimeout seconds
+// (0: three times the average tile time so far); whichever copy comes back first is used. Only
+// returns once every tile is written.
+bool runTileCoordinator(int port, const TileJob& job, ImageWriter& writer, double tileTimeout);
+
+// Connects to a coordinator at host:port and renders the tiles it hands out until it says the job is done
+bool runTileWorker(const std::string& host, int port, const TileJobFunction& setup, const TileRenderFunction& render);
+
+#endif
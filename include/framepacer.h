@@ -0,0 +1,52 @@
+#ifndef FRAMEPACER_H
+#define FRAMEPACER_H
+
+#include <chrono>
+
+// Picks how many accumulation passes to render per displayed frame so their GPU time stays close to a
+// budget. Pass times are measured with pairs of GL_TIMESTAMP queries (so they can overlap the profiler's
+// GL_TIME_ELAPSED queries) that are only read back once available, a few frames later, so pacing never
+// stalls the pipeline. The CPU time spent submitting the passes
+// counts too, for drivers that do the work at submission (llvmpipe runs compute dispatches inline).
+class FramePacer {
+public:
+    FramePacer(double budgetMilliseconds, int maxPassesPerFrame = 256);
+    ~FramePacer();
+
+    bool init();
+
+    int passesPerFrame() const { return m_passesPerFrame; }
+    double millisecondsPerPass() const { return m_millisecondsPerPass; }
+
+    // Wrap the accumulation passes of one frame
+    void beginPasses();
+    void endPasses(int passesRendered);
+
+    // Call when a pass gets more or less expensive (scene or settings edits, a new view after the preview),
+    // so the estimate starts over
+    void reset();
+
+private:
+    FramePacer(const FramePacer&);
+    FramePacer& operator=(const FramePacer&);
+
+    void collectResults();
+
+    static const int QUERY_COUNT = 4; // Frames in flight before a result is needed
+
+    double m_budgetMilliseconds;
+    int m_maxPassesPerFrame;
+    int m_passesPerFrame;
+    double m_millisecondsPerPass; // Smoothed, 0 until the first result arrives
+
+    unsigned int m_queries[QUERY_COUNT][2]; // Start and end timestamps
+    // Passes measured by each query while in flight, or one of the QUERY_* states below
+    int m_queryPasses[QUERY_COUNT];
+    double m_queryCpuMilliseconds[QUERY_COUNT];
+    int m_current;
+    bool m_warmedUp; // The first result after init/reset() includes one-off costs and is dropped
+    std::chrono::steady_clock::time_point m_passesStart;
+    bool m_supported;
+};
+
+#endif
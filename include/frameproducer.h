@@ -0,0 +1,65 @@
+#ifndef FRAMEPRODUCER_H
+#define FRAMEPRODUCER_H
+
+#include "threadpool.h"
+#include <atomic>
+#include <functional>
+#include <thread>
+
+// Fills rows [rowBegin, rowEnd) of an RGBA float frame. Called from several pool threads at once.
+typedef std::function<void(float* pixels, int width, int height, int rowBegin, int rowEnd, unsigned int frameIndex)> FrameSource;
+// Called on the producer thread once every row of a frame is done, before the next frame starts
+typedef std::function<void(unsigned int frameIndex)> FrameEnd;
+
+// Produces CPU frames on a dedicated thread (spreading the rows over a ThreadPool) and hands them to the
+// display thread through a lock-free triple buffer. The producer always has a buffer to write into and the
+// consumer always gets the newest finished frame, so neither ever waits on the other. The three buffers
+// belong to the caller, typically the mapped upload slots of a FrameStream, so frames are written where
+// the GPU reads them and the display thread never touches the pixels.
+class FrameProducer {
+public:
+    static const int BUFFER_COUNT = 3;
+
+    // buffers holds BUFFER_COUNT pointers to width * height * 4 floats each
+    FrameProducer(int width, int height, float* const* buffers, const FrameSource& source, int threadCount = 0,
+                  const FrameEnd& frameEnd = FrameEnd());
+    ~FrameProducer();
+
+    void start();
+    void stop();
+
+    // Display thread only. frameReady() is true if a frame was finished since the last acquireLatest().
+    // acquireLatest() then returns the index of its buffer, -1 without one, and hands the buffer
+    // returned before (frontBuffer()) back to the producer: only call it once that buffer is no longer read.
+    bool frameReady() const { return (m_shared.load(std::memory_order_relaxed) & FRESH_BIT) != 0; }
+    int frontBuffer() const { return m_frontIndex; }
+    int acquireLatest();
+
+    unsigned int producedFrames() const { return m_producedFrames.load(std::memory_order_relaxed); }
+
+private:
+    FrameProducer(const FrameProducer&);
+    FrameProducer& operator=(const FrameProducer&);
+
+    void produceLoop();
+
+    static const unsigned int FRESH_BIT = 4; // Set in m_shared when it holds a frame the consumer hasn't seen
+    static const unsigned int INDEX_MASK = 3;
+
+    int m_width;
+    int m_height;
+    FrameSource m_source;
+    FrameEnd m_frameEnd;
+    ThreadPool m_pool;
+
+    float* m_buffers[BUFFER_COUNT];
+    int m_backIndex;                  // Producer-owned
+    int m_frontIndex;                 // Consumer-owned
+    std::atomic<unsigned int> m_shared; // Index of the buffer in the middle, plus FRESH_BIT
+
+    std::thread m_thread;
+    std::atomic<bool> m_running;
+    std::atomic<unsigned int> m_producedFrames;
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef FRAMESTREAM_H
+#define FRAMESTREAM_H
+
+#include <glad/glad.h>
+#include <cstddef>
+
+// Streams CPU-produced RGBA float frames into a texture through a persistently mapped, triple-buffered
+// pixel unpack buffer. Each slot is guarded by a fence, so the CPU writes into a slot the GPU is done with
+// and glTexSubImage2D is a GPU-side copy that doesn't stall the caller. Slots can be written from any
+// thread (the mapping is coherent) and uploaded in any order, so a FrameProducer can render straight into
+// them. Needs GL 4.4 (buffer storage).
+class FrameStream {
+public:
+    static const int SLOT_COUNT = 3;
+
+    FrameStream(int width, int height);
+    ~FrameStream();
+
+    bool init();
+
+    // width * height * 4 floats. Valid from init() on.
+    float* slot(int index) const { return m_mapped + (m_frameSize / sizeof(float)) * index; }
+    // False while the GPU still reads the slot's last upload. Only polls, never waits on the driver: the
+    // caller keeps showing the previous frame instead.
+    bool slotIdle(int index);
+    // Queues the upload of the slot into texture()
+    void upload(int index);
+
+    unsigned int texture() const { return m_texture; }
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+
+private:
+    FrameStream(const FrameStream&);
+    FrameStream& operator=(const FrameStream&);
+
+    int m_width;
+    int m_height;
+    size_t m_frameSize; // In bytes
+
+    unsigned int m_texture;
+    unsigned int m_buffer;
+    float* m_mapped;
+    GLsync m_fences[SLOT_COUNT];
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <fstream>
+#include <memory>
+#include <string>
+
+// Floats per pixel of the rows handed to an ImageWriter: RGBA, and with AOVs also the renderer's
+// FEATURE_ALBEDO (albedo, object index) and FEATURE_NORMAL_DEPTH (world normal, depth) buffers after it
+static const int IMAGE_CHANNELS = 4;
+static const int IMAGE_CHANNELS_WITH_AOVS = 12;
+
+// Writes an image a few rows at a time, so a render can be saved without a second full-size copy.
+// Rows are pixels of linear radiance, IMAGE_CHANNELS or IMAGE_CHANNELS_WITH_AOVS floats each, and arrive
+// top row first. Alpha is the pixel's sample count, which only writers created with sampleCounts keep.
+class ImageWriter {
+public:
+    virtual ~ImageWriter() {}
+
+    virtual bool writeRows(const float* rgba, int rowCount) = 0;
+    // Writes a width x height block at (x, y), counted from the top left, in any order. For EXR this
+    // needs a tiled file, and the blocks have to be its tiles.
+    virtual bool writeTile(int x, int y, int width, int height, const float* rgba) = 0;
+    // Flushes and closes the file, false if anything went wrong on the way
+    virtual bool finish() = 0;
+};
+
+// OpenEXR compression methods, values as stored in the file header
+enum ExrCompression {
+    EXR_NO_COMPRESSION = 0,
+    EXR_ZIPS_COMPRESSION = 2, // zlib, one scanline per block
+    EXR_ZIP_COMPRESSION = 3   // zlib, 16 scanlines per block
+};
+
+// Picks the format from the file extension:
+// - .ppm: 8-bit, clamped like the window output
+// - .pfm: 32-bit float RGB
+// - .exr: OpenEXR, RGB as half or float channels. Scanlines, or tileSize x tileSize tiles if tileSize > 0.
+//   With sampleCounts, alpha goes to an extra float channel "spp", so the file can be merged with others.
+//   With aovs, the AOVs become the layers "albedo" (R, G, B, as half floats if the radiance is), "N"
+//   (X, Y, Z) and the channels "Z" (depth) and "id" (object index).
+// With aovs the rows have IMAGE_CHANNELS_WITH_AOVS floats per pixel; only EXR files store the extra ones.
+// The image goes to path.tmp first and only replaces path in a successful finish(), an unfinished writer
+// removes it again. Returns NULL (and logs) for unknown extensions or if the file can't be created.
+std::unique_ptr<ImageWriter> createImageWriter(const std::string& path, int width, int height, bool halfFloat = false,
+                                               ExrCompression compression = EXR_ZIP_COMPRESSION, int tileSize = 0,
+                                               bool sampleCounts = false, bool aovs = false);
+
+// Reads an image a few rows at a time, top row first, as RGBA floats with the sample count in alpha
+// (0 if the file has none).
+class ImageReader {
+public:
+    virtual ~ImageReader() {}
+
+    virtual int width() const = 0;
+    virtual int height() const = 0;
+    virtual bool hasSampleCounts() const = 0;
+    // out must hold rowCount * width() * 4 floats. Reading top to bottom decodes every block once.
+    virtual bool readRows(int rowBegin, int rowCount, float* rgba) = 0;
+};
+
+// Opens OpenEXR files with half or float R, G, B and spp channels, as scanlines or single-level tiles,
+// uncompressed or ZIP/ZIPS compressed: everything createImageWriter() writes.
+// Returns NULL (and logs) for other files.
+std::unique_ptr<ImageReader> openImageReader(const std::string& path);
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <chrono>
+#include <fstream>
+#include <string>
+
+enum ProfileStage {
+    STAGE_UPLOAD,       // CPU frame texture upload
+    STAGE_ACCUMULATION, // Path tracing passes
+    STAGE_OUTPUT,       // Direct output pass to the window
+    STAGE_COUNT
+};
+
+// Per-frame timings of the render loop stages, written as one CSV row (or JSON line, if the log path ends
+// in .json/.jsonl) per frame so runs of different builds can be diffed. Every stage gets its CPU time and
+// a GL_TIME_ELAPSED query. Queries are spread over a ring of frames and only read once available, so the
+// profiler never waits on the GPU; a frame whose results aren't ready when its slot comes around again is
+// logged without GPU times.
+class FrameProfiler {
+public:
+    // An empty logPath gives a disabled profiler whose calls do nothing, so call sites need no checks
+    explicit FrameProfiler(const std::string& logPath);
+    ~FrameProfiler();
+
+    bool init();
+    bool enabled() const { return !m_logPath.empty(); }
+
+    void beginFrame();
+    void endFrame();
+
+    // Stages don't nest, only one can be open at a time
+    void beginStage(ProfileStage stage);
+    void endStage();
+
+    void setPasses(int passes);
+    // Texture tile lookups of the CPU frame shown this frame, see TiledTexture
+    void setTileStats(long long hits, long long misses, long long bypassed, long long evictions);
+
+private:
+    FrameProfiler(const FrameProfiler&);
+    FrameProfiler& operator=(const FrameProfiler&);
+
+    static const int FRAMES_IN_FLIGHT = 3;
+
+    struct FrameRecord {
+        bool pending;
+        unsigned int frameIndex;
+        double cpuStart;  // Milliseconds since init()
+        double cpuFrame;
+        int passes;
+        long long tileHits;
+        long long tileMisses;
+        long long tileBypassed;
+        long long tileEvictions;
+        double cpuStage[STAGE_COUNT]; // Negative if the stage didn't run
+        bool stageIssued[STAGE_COUNT];
+        unsigned int queries[STAGE_COUNT];
+    };
+
+    double millisecondsSinceStart() const;
+    void finishRecord(FrameRecord& record, bool wait);
+    void writeHeader();
+
+    std::string m_logPath;
+    std::ofstream m_log;
+    bool m_json;
+
+    FrameRecord m_records[FRAMES_IN_FLIGHT];
+    unsigned int m_frameIndex;
+    int m_openStage;
+    double m_stageStart;
+
+    std::chrono::steady_clock::time_point m_start;
+};
+
+#endif
@@ -0,0 +1,199 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include "camera.h"
+#include "scene.h"
+#include "shader.h"
+#include "skycube.h"
+#include "textureloader.h"
+#include <memory>
+#include <vector>
+
+enum RenderBackend {
+    BACKEND_FRAGMENT, // Full-screen fragment pass, ping-ponging between two FBOs
+    BACKEND_COMPUTE   // 8x8 compute tiles accumulating in place with imageLoad/imageStore (GL 4.3)
+};
+
+enum AccumulationMode {
+    ACCUMULATE_SUM,          // RGBA32F, passes are summed and divided by the pass count on display
+    ACCUMULATE_AVERAGE,      // RGBA32F running average, each pass blended in with weight 1/n
+    ACCUMULATE_AVERAGE_HALF  // RGBA16F running average: half the memory and bandwidth, meant for interactive sessions
+};
+
+// Per-pixel data of the first hit, averaged over the passes like the radiance
+enum FeatureBuffer {
+    FEATURE_ALBEDO,       // Material albedo in rgb, 1 where the camera ray missed. Object index in a: into
+                          // Scene::objects, -1 where the camera ray missed, -2 on the ground plane.
+    FEATURE_NORMAL_DEPTH, // World normal in xyz, distance along the camera ray in w
+    FEATURE_COUNT
+};
+
+// Drives the GPU path tracer in shaders/pathtracer.glsl. Every renderPass() adds one pass to the
+// accumulation texture, present() draws the averaged result to the current framebuffer.
+class Renderer {
+public:
+    Renderer(int width, int height, RenderBackend backend, AccumulationMode accumulation = ACCUMULATE_SUM);
+    ~Renderer();
+
+    // Compiles the shaders and allocates the accumulation targets. Needs a current GL 4.3 context.
+    bool init();
+
+    // Also keeps the FeatureBuffer targets, e.g. as denoiser guides. Has to be called before init().
+    void setFeatureBuffers(bool enabled) { m_featureBuffers = enabled; }
+
+    // Keeps the accumulation when the camera moves: the next pass reprojects it to the new view through
+    // the first hit's depth, and starts over only where surfaces were disoccluded. Needs the
+    // FEATURE_NORMAL_DEPTH buffer, so it also turns on the feature buffers. Has to be called before init().
+    void setTemporalReprojection(bool enabled) { m_reprojection = enabled; }
+
+    // Traces only every other pixel per pass, in a checkerboard whose parity alternates between passes,
+    // for about half the cost of a pass. Pixels converge as before at half the passes each; until a pixel
+    // has been traced once, present() shows the average of its neighbours. Compute backend only: fragment
+    // shading runs in 2x2 quads, which always hold both parities. Has to be called before init().
+    void setCheckerboard(bool enabled) { m_checkerboard = enabled; }
+
+    // Decodes the skybox on loader's threads instead of the renderer's own, sharing decodes with whoever
+    // else uses it. Lets a caller start decoding before the GL context exists, see loadSkybox(). Has to
+    // be called before init(), loader has to outlive the renderer.
+    void setTextureLoader(TextureLoader* loader) { m_textureLoader = loader; }
+
+    // Passes render with the sky as it was (the flat sky at first) until a new skybox is decoded, and
+    // the accumulation starts over once it's in. Otherwise the first pass after init() or setScene()
+    // waits for the skybox, for renders that have to match from the first pass on.
+    void setStreamTextures(bool enabled) { m_streamTextures = enabled; }
+
+    // Off keeps a skybox that fails to load from being reported, e.g. by throwaway renderers that time
+    // the backends while the one that's kept reports it
+    void setReportTextureErrors(bool enabled) { m_reportTextureErrors = enabled; }
+
+    // Starts decoding a skybox the way the renderer asks for it. Holding the request until init() or
+    // setScene() with the same loader hands the decode over instead of starting another.
+    static std::shared_ptr<TextureRequest> loadSkybox(TextureLoader& loader, const std::string& path) {
+        return loader.load(path, 3, false);
+    }
+
+    void setScene(const Scene& scene);
+    // Starts the accumulation over, unless temporal reprojection is on
+    void setCamera(const Camera& camera);
+    void setSelectedObject(int index) { m_selectedObject = index; }
+
+    // Number of workgroups kept resident by the compute backend. Each one keeps fetching 8x8 tiles
+    // from a shared counter until the frame is done. 0 dispatches one workgroup per tile instead.
+    void setPersistentWorkgroups(int count) { m_persistentWorkgroups = count; }
+
+    // Makes the render target the width() x height() window at (x, y) of an imageWidth x imageHeight
+    // image, counted from the bottom left like GL rows, for rendering the image bucket by bucket.
+    // The window may reach past the image edges. By default the target is the whole image.
+    void setImageRegion(int imageWidth, int imageHeight, int x, int y);
+
+    // Selects an independent sequence of samples. Renders of the same frame with different seeds can be
+    // merged into one with more samples per pixel. Seed 0 is the default sequence.
+    void setSampleSeed(int seed) { m_sampleSeed = seed; }
+
+    void resetAccumulation() { m_accumulatedPasses = 0; m_featurePasses = 0; m_reprojectPending = false; m_passRow = 0; }
+    void renderPass();
+    // Renders the next rowCount rows of the current pass, counted from the bottom, so a heavy pass can be
+    // spread over several frames. The pass only counts once its last row is done; returns true then.
+    // The compute backend rounds rows up to whole 8x8 tiles.
+    bool renderPassRows(int rowCount);
+    // True while the accumulation doesn't show the current view: after a reset or a reprojecting camera
+    // move, until the next pass is complete. present() then only draws the rows that pass has finished.
+    bool refining() const { return m_accumulatedPasses == 0 || m_reprojectPending; }
+    // Scales to the viewport, bilinearly if the target is smaller (e.g. a low resolution preview)
+    void present(int viewportWidth, int viewportHeight);
+
+    // Reads rows [rowBegin, rowBegin + rowCount) of the averaged radiance as RGBA floats, bottom row first,
+    // with the pixel's pass count in alpha. Waits for the GPU. out must hold rowCount * width() * 4 floats.
+    void readRows(int rowBegin, int rowCount, float* out);
+
+    // Same as readRows() for a feature buffer. Needs setFeatureBuffers(true).
+    void readFeatureRows(FeatureBuffer feature, int rowBegin, int rowCount, float* out);
+
+    // Copies the accumulation target on the GPU, so it can be read back piece by piece while rendering
+    // goes on. Returns the pass count of the snapshot.
+    int snapshotAccumulation();
+    // Reads rows of the last snapshot as stored, i.e. not divided by the pass count in ACCUMULATE_SUM mode
+    void readSnapshotRows(int rowBegin, int rowCount, float* out);
+    // Replaces the accumulation target with width() * height() RGBA floats as read by readSnapshotRows().
+    // The feature buffers start over.
+    void loadAccumulation(const float* rgba, int passes);
+
+    // Passes since the accumulation last started over. With temporal reprojection, pixels can hold
+    // fewer or more (see readRows()).
+    int accumulatedPasses() const { return m_accumulatedPasses; }
+    // Samples per pixel every pass traces, the scene's framePasses
+    int samplesPerPass() const { return m_scene.settings.framePasses; }
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    RenderBackend backend() const { return m_backend; }
+    AccumulationMode accumulationMode() const { return m_accumulation; }
+
+private:
+    Renderer(const Renderer&);
+    Renderer& operator=(const Renderer&);
+
+    void uploadDirtyBlocks();
+    void setPassUniforms(const Shader& shader) const;
+    void renderFragmentPass(int rowBegin, int rowEnd);
+    void renderComputePass(int rowBegin, int rowEnd);
+    unsigned int outputTexture() const;
+    void readTextureRows(unsigned int texture, int rowBegin, int rowCount, float* out);
+    GLenum accumulationFormat() const;
+    void installPendingSkybox();
+    void updateSky();
+
+    int m_width;
+    int m_height;
+    int m_imageWidth;
+    int m_imageHeight;
+    int m_regionX;
+    int m_regionY;
+    RenderBackend m_backend;
+    AccumulationMode m_accumulation;
+
+    Scene m_scene;
+    Camera m_camera;
+    int m_selectedObject;
+    int m_sampleSeed; // u_sampleSeed, hashed into the shader's random numbers
+    int m_accumulatedPasses;
+    bool m_featureBuffers;
+    int m_featurePasses; // Can be fewer than m_accumulatedPasses after loadAccumulation()
+    int m_persistentWorkgroups;
+    int m_passRow; // Rows of the current pass rendered so far, see renderPassRows()
+    bool m_reprojection;
+    bool m_checkerboard;
+    bool m_reprojectPending; // The camera moved since the last pass
+    Camera m_previousCamera; // The camera the accumulation was rendered with, while m_reprojectPending
+
+    std::unique_ptr<Shader> m_displayShader; // Also runs the accumulation passes of the fragment backend
+    std::unique_ptr<Shader> m_computeShader;
+
+    unsigned int m_quadVAO, m_quadVBO, m_quadEBO;
+    unsigned int m_accumulationTextures[2];
+    unsigned int m_featureTextures[2][FEATURE_COUNT]; // Ping-ponged alongside the accumulation textures
+    unsigned int m_framebuffers[2];
+    unsigned int m_readFramebuffer; // Created on the first readback
+    unsigned int m_snapshotTexture; // Created on the first snapshotAccumulation()
+    unsigned int m_historyTextures[2]; // Compute backend with reprojection: accumulation and normal-depth copies
+    int m_readIndex; // Fragment backend: which texture holds the latest accumulation
+    unsigned int m_tileCounterBuffer;
+    unsigned int m_presentSampler; // Bilinear, for targets smaller than the viewport
+    unsigned int m_skyboxTexture; // Cube map of the sky's radiance, see skycube.h
+    TextureLoader* m_textureLoader; // m_ownTextureLoader unless setTextureLoader() gave another
+    std::unique_ptr<TextureLoader> m_ownTextureLoader;
+    bool m_streamTextures;
+    bool m_reportTextureErrors;
+    std::shared_ptr<TextureRequest> m_skybox; // The image the sky textures hold, null for the flat sky
+    std::shared_ptr<TextureRequest> m_pendingSkybox; // Of the current scene, until installPendingSkybox()
+    unsigned int m_skySamplerTexture; // Alias table of the sky (see skysampler.h), 0 if there's nothing to sample
+    unsigned int m_skyPrefilteredTexture; // Cube map with a mip level per specular roughness, see prefilterSkyCube()
+    float m_skyDiffuse[SKY_DIFFUSE_COEFFICIENTS][3]; // See projectSkyDiffuse()
+
+    // Camera, settings and scene uniform blocks (bindings 0-2), each re-uploaded only when its flag is set
+    unsigned int m_uniformBuffers[3];
+    bool m_cameraDirty;
+    bool m_settingsDirty;
+    bool m_sceneDirty;
+};
+
+#endif
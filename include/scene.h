@@ -0,0 +1,81 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "camera.h"
+#include "utils.h"
+#include <istream>
+#include <string>
+#include <vector>
+
+// Must match the limits in shaders/pathtracer.glsl
+const int MAX_OBJECT_COUNT = 64;
+const int MAX_LIGHT_COUNT = 4;
+
+enum ObjectType {
+    OBJECT_NONE = 0,
+    OBJECT_SPHERE = 1,
+    OBJECT_BOX = 2
+};
+
+struct Material {
+    Vec3 albedo;
+    Vec3 specular;
+    Vec3 emission;
+    float emissionStrength;
+    float roughness;
+    float specularHighlight;
+    float specularExponent;
+};
+
+struct Object {
+    unsigned int type;
+    Vec3 position;
+    Vec3 scale; // Spheres only use scale.x as their radius
+    Material material;
+};
+
+struct PointLight {
+    Vec3 position;
+    float radius;
+    Vec3 color;
+    float power;
+    float reach; // Only points within this distance of the light will be affected
+};
+
+// Integrator settings, uploaded as the u_* settings uniforms
+struct RenderSettings {
+    int shadowResolution;
+    int lightBounces;
+    int framePasses;
+    float blur;
+    float bloomRadius;
+    float bloomIntensity;
+    float skyboxStrength;
+    float skyboxGamma;
+    float skyboxCeiling;
+    int skyCacheDepth; // Bounces from this depth on end in the sky's cached average, 0 traces them all
+};
+
+struct Scene {
+    std::vector<Object> objects;
+    std::vector<PointLight> lights;
+    bool planeVisible;
+    Material planeMaterial;
+    RenderSettings settings;
+    std::string skyboxPath;
+};
+
+Material makeMaterial(Vec3 albedo, Vec3 specular, float roughness);
+Scene createDefaultScene();
+
+// Reads a text scene description (see scenes/default.scene) on top of the default settings, with no
+// objects or lights. Logs the offending line and returns false on errors.
+bool loadScene(const std::string& path, Scene& scene, Camera& camera);
+// The same for a scene description that doesn't come from a file. name is only used in error messages.
+bool parseScene(std::istream& input, const std::string& name, Scene& scene, Camera& camera);
+
+// FNV-1a over everything that affects the rendered image, to tell whether saved render state
+// (e.g. a checkpoint) belongs to this scene and view
+unsigned long long hashScene(const Scene& scene, const Camera& camera);
+
+#endif
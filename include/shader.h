@@ -0,0 +1,44 @@
+#ifndef SHADER_H
+#define SHADER_H
+
+#include <glad/glad.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A linked GL program built from GLSL files. Each stage is the concatenation of its files, in order,
+// so shared code (pathtracer.glsl) can be put in front of a stage's main() without an #include mechanism.
+class Shader {
+public:
+    unsigned int id;
+
+    Shader(const std::vector<std::string>& vertexPaths, const std::vector<std::string>& fragmentPaths);
+    // defines (e.g. "#define FOO\n") are inserted right after the #version line of the first file
+    explicit Shader(const std::vector<std::string>& computePaths, const std::string& defines = "");
+    ~Shader();
+
+    bool valid() const { return id != 0; }
+    void use() const;
+
+    // Looked up once per name, later calls hit the cache instead of the driver
+    int location(const std::string& name) const;
+    void setBool(const std::string& name, bool value) const;
+    void setInt(const std::string& name, int value) const;
+    void setUint(const std::string& name, unsigned int value) const;
+    void setFloat(const std::string& name, float value) const;
+    void setVec2i(const std::string& name, int x, int y) const;
+    void setVec3(const std::string& name, const float* value) const;
+    void setVec4(const std::string& name, float x, float y, float z, float w) const;
+    void setMat4(const std::string& name, const float* value) const;
+
+private:
+    Shader(const Shader&);
+    Shader& operator=(const Shader&);
+
+    mutable std::unordered_map<std::string, int> m_locations;
+
+    static unsigned int compileStage(GLenum type, const std::vector<std::string>& paths, const std::string& defines = "");
+    static unsigned int link(const std::vector<unsigned int>& stages);
+};
+
+#endif
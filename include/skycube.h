@@ -0,0 +1,28 @@
+#ifndef SKYCUBE_H
+#define SKYCUBE_H
+
+#include <vector>
+
+// Resamples an equirectangular sky into a cube map once, so the path tracer finds the sky in a direction
+// with a single fetch instead of an atan, an asin and a pow per ray, see sampleSkybox() in
+// shaders/pathtracer.glsl.
+// radiance holds width * height RGB floats, rows top first, and is filtered bilinearly the way the sky
+// texture used to be. faces gets six faceSize * faceSize RGB float images in GL's order
+// (+X, -X, +Y, -Y, +Z, -Z), ready for glTexImage2D on GL_TEXTURE_CUBE_MAP_POSITIVE_X + face.
+void bakeSkyCube(const float* radiance, int width, int height, int faceSize, std::vector<float>& faces);
+
+// Averages a cube map down to faces of size texels, weighting its texels by their solid angle
+void downsampleSkyCube(const std::vector<float>& faces, int faceSize, int size, std::vector<float>& out);
+
+// Mip levels of a cube map blurred for increasingly rough specular bounces: level k of levels holds the
+// average of the sky over the Phong lobe of roughness k / (levels - 1), around each texel's direction,
+// at faceSize >> k texels. faceSize must be a power of two at least 1 << (levels - 1).
+void prefilterSkyCube(const std::vector<float>& faces, int faceSize, int levels, std::vector<std::vector<float> >& mips);
+
+// The sky as seen by a diffuse bounce, in real spherical harmonics up to order 3: the bounces weight the
+// sky by the cosine twice (once picking the direction, once in the energy), which those orders hold
+// almost exactly. See skyDiffuse() in shaders/pathtracer.glsl.
+static const int SKY_DIFFUSE_COEFFICIENTS = 16;
+void projectSkyDiffuse(const std::vector<float>& faces, int faceSize, float coefficients[SKY_DIFFUSE_COEFFICIENTS][3]);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef SKYSAMPLER_H
+#define SKYSAMPLER_H
+
+#include <vector>
+
+// Alias table (Vose's method) for picking texels of an equirectangular sky in proportion to their
+// luminance times their solid angle, in constant time. The path tracer uses it to aim shadow rays at
+// the bright parts of the sky, see sampleSkyDirection() in shaders/pathtracer.glsl.
+struct SkySampler {
+    int width;
+    int height;
+    // RGBA floats per texel, rows top first like the sky image: the probability of keeping the texel
+    // when its slot is drawn, the index of the texel taken otherwise, the texel's own probability
+    // times width * height, and 0
+    std::vector<float> table;
+};
+
+// radiance holds width * height RGB floats, rows top first. Returns false if the sky is black.
+bool buildSkySampler(const float* radiance, int width, int height, SkySampler& sampler);
+
+#endif
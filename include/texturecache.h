@@ -0,0 +1,28 @@
+#ifndef TEXTURECACHE_H
+#define TEXTURECACHE_H
+
+#include "textureloader.h"
+#include <cstddef>
+#include <string>
+
+// Decoded textures on disk, one file per source image content and load options. A file holds a header,
+// the level table and then every level's texels as TextureImage holds them, so it's used through mmap
+// without a copy: texels are read from the page cache as the GL upload touches them.
+
+unsigned long long hashContents(const unsigned char* data, size_t size);
+
+// directory/<16 hex digits of contentHash>-<channels><m if mipmapped>.tex
+std::string textureCachePath(const std::string& directory, unsigned long long contentHash, int channels, bool mipmaps);
+
+// Maps a cache file into image. Returns false if it's missing, truncated, from another version or for
+// other contents.
+bool mapTextureCache(const std::string& path, unsigned long long contentHash, TextureImage& image);
+
+// Writes image to a temporary file next to path and renames it into place, so concurrent readers see
+// the whole file or none. Creates the directory if needed.
+bool writeTextureCache(const std::string& path, unsigned long long contentHash, const TextureImage& image);
+
+// $XDG_CACHE_HOME/raytracer/textures, or ~/.cache/raytracer/textures. Empty if neither variable is set.
+std::string defaultTextureCacheDirectory();
+
+#endif
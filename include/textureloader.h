@@ -0,0 +1,89 @@
+#ifndef TEXTURELOADER_H
+#define TEXTURELOADER_H
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// One mip level of a decoded image, rows top first. Radiance HDR files (.hdr) decode to linear floats,
+// everything else to bytes. The texels live in the image's memory.
+struct TextureLevel {
+    int width;
+    int height;
+    const void* texels;
+
+    const unsigned char* bytes() const { return (const unsigned char*)texels; }
+    const float* floats() const { return (const float*)texels; }
+};
+
+struct TextureImage {
+    int channels;
+    bool hdr;
+    std::vector<TextureLevel> levels; // The full image first, then each mip level if they were asked for
+    std::shared_ptr<const void> memory; // Holds every level: a decode buffer or a mapped cache file
+};
+
+// A decode in flight. Whoever asked for it polls ready() from the render loop or blocks in wait().
+class TextureRequest {
+public:
+    TextureRequest(const std::string& path, int channels, bool mipmaps);
+
+    const std::string& path() const { return m_path; }
+    bool ready() const;
+    // Blocks until the image is decoded. Returns false if it couldn't be, error() says why.
+    bool wait() const;
+    // Only valid once ready() or wait() returned
+    const TextureImage& image() const { return m_image; }
+    const std::string& error() const { return m_error; }
+
+private:
+    friend class TextureLoader;
+
+    std::string m_path;
+    int m_channels; // 0 keeps the file's
+    bool m_mipmaps;
+    TextureImage m_image;
+    std::string m_error;
+    bool m_done;
+    bool m_ok;
+    mutable std::mutex m_mutex;
+    mutable std::condition_variable m_finished;
+};
+
+// Decodes images with stb_image on worker threads, so a caller can start loading before its GL context
+// exists and upload once the pixels are in. Mip levels are box filtered on the workers too, the GL
+// thread only uploads them. Asking for an image that's still held by an earlier request with the same
+// options shares that request instead of decoding twice. With a cache directory, decoded images with
+// their mips are kept there by content hash (see texturecache.h) and later loads of the same file map
+// them instead of decoding.
+class TextureLoader {
+public:
+    // threadCount 0 uses one thread per hardware thread. An empty cacheDirectory decodes every time.
+    explicit TextureLoader(int threadCount = 0, const std::string& cacheDirectory = "");
+    // Waits for the decodes in progress, queued ones fail
+    ~TextureLoader();
+
+    // channels 1-4 converts the image to that many, 0 keeps the file's
+    std::shared_ptr<TextureRequest> load(const std::string& path, int channels, bool mipmaps);
+
+private:
+    TextureLoader(const TextureLoader&);
+    TextureLoader& operator=(const TextureLoader&);
+
+    void workerLoop();
+
+    std::string m_cacheDirectory;
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::deque<std::shared_ptr<TextureRequest> > m_queue;
+    std::map<std::string, std::weak_ptr<TextureRequest> > m_requests; // By path and options
+    bool m_stop;
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for data-parallel loops. Chunks are handed out through an atomic
+// counter, so threads that finish early keep taking work (rows with expensive pixels don't stall the rest).
+class ThreadPool {
+public:
+    // threadCount 0 uses one thread per hardware thread. The calling thread counts as one of them.
+    explicit ThreadPool(int threadCount = 0);
+    ~ThreadPool();
+
+    // Runs fn(begin, end) over [0, count) in chunks of chunkSize, blocks until every chunk is done
+    void parallelFor(int count, int chunkSize, const std::function<void(int, int)>& fn);
+
+    int threadCount() const { return (int)m_workers.size() + 1; }
+
+private:
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    void workerLoop();
+    void runChunks();
+
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+
+    const std::function<void(int, int)>* m_job;
+    int m_count;
+    int m_chunkSize;
+    std::atomic<int> m_nextChunk;
+    unsigned int m_generation; // Bumped for every parallelFor() so sleeping workers notice new work
+    int m_busyWorkers;
+    bool m_stop;
+};
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef TILEDTEXTURE_H
+#define TILEDTEXTURE_H
+
+#include "textureloader.h"
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Lookups a render thread made while filling its rows. Kept per thread and added to the texture once
+// per band, so lookups don't contend on shared counters.
+struct TileCounts {
+    long long hits;
+    long long misses;   // Including the bypassed ones
+    long long bypassed; // Misses read straight from the image, the budget had no tile left to load into
+};
+
+// One frame's worth of tile traffic, see TiledTexture::endFrame()
+struct TileStats {
+    long long hits;
+    long long misses;
+    long long bypassed;
+    long long evictions; // Made by endFrame() to free tiles for the next frame
+    int residentTiles;
+    size_t residentBytes;
+};
+
+// Demand-paged view of a texture for CPU render threads. Every mip level is split into fixed-size
+// tiles, which are copied out of the image the first time a lookup touches them. Tiles never take more
+// than the memory budget: a miss takes a free tile, and if there is none left it reads the texel from the
+// image without caching it. endFrame() frees tiles for the next frame, as many as the last one asked for,
+// with a clock sweep that evicts tiles not looked up since the previous sweep first. Eviction only happens
+// there, while no lookups run, so tiles are reused at once and lookups that hit are a single atomic load.
+// With an image mapped from the texture cache (texturecache.h) only the tiles in use are resident; the
+// rest of the file stays on disk.
+class TiledTexture {
+public:
+    // image must stay valid (its memory is shared, copies are fine). The budget is rounded down to
+    // whole tiles, with room for at least one.
+    TiledTexture(const TextureImage& image, int tileSize, size_t budgetBytes);
+    ~TiledTexture();
+
+    int levelCount() const { return (int)m_levels.size(); }
+    int width(int level) const { return m_levels[level].width; }
+    int height(int level) const { return m_levels[level].height; }
+
+    // Texel (x, y) of level, wrapped around the edges, as RGBA floats (bytes scaled to [0, 1]). Grey images
+    // fill every color channel, images without alpha get 1. Safe from any number of threads at once.
+    void fetch(int level, int x, int y, float* rgba, TileCounts& counts);
+    // Bilinear lookup at texture coordinates (u, v), v = 0 on the top row, on the level nearest lod
+    void sample(float u, float v, float lod, float* rgba, TileCounts& counts);
+
+    void addCounts(const TileCounts& counts);
+
+    // Between frames only, with no lookups running: evicts tiles for the next frame and returns the
+    // statistics of the one that ended. lastFrameStats() keeps them for other threads.
+    TileStats endFrame();
+    TileStats lastFrameStats() const;
+
+private:
+    TiledTexture(const TiledTexture&);
+    TiledTexture& operator=(const TiledTexture&);
+
+    struct Tile {
+        int level;
+        int index; // In its level's page table, -1 while the tile is free
+        std::atomic<bool> referenced; // Looked up since the clock hand last passed
+        std::vector<unsigned char> texels;
+    };
+
+    struct Level {
+        int width;
+        int height;
+        int tilesX;
+        int tilesY;
+        std::unique_ptr<std::atomic<Tile*>[]> pages; // Row-major tiles, NULL until loaded
+    };
+
+    Tile* loadTile(int level, int index);
+    void readTexel(const unsigned char* texels, size_t texel, float* rgba) const;
+
+    TextureImage m_image;
+    int m_tileSize;
+    size_t m_texelSize;
+    size_t m_tileBytes;
+    int m_maxTiles;
+    std::vector<Level> m_levels;
+
+    mutable std::mutex m_mutex; // Guards everything below. Lookups only take it on misses.
+    std::vector<Tile*> m_tiles; // Every tile allocated so far, at most m_maxTiles, in clock order
+    std::vector<Tile*> m_free;
+    size_t m_hand;
+    long long m_hits;
+    long long m_misses;
+    long long m_bypassed;
+    long long m_loads;
+    TileStats m_lastFrame;
+};
+
+#endif
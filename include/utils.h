@@ -0,0 +1,13 @@
+#ifndef UTILS_H
+#define UTILS_H
+
+#include <string>
+
+struct Vec3 {
+    float x, y, z;
+};
+
+// Reads a whole text file, returns an empty string (and logs) on failure
+std::string readFile(const std::string& path);
+
+#endif
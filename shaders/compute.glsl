@@ -0,0 +1,100 @@
+// Compiled after pathtracer.glsl, which holds the shared declarations and the integrator
+
+#define TILE_SIZE 8
+
+layout(local_size_x = TILE_SIZE, local_size_y = TILE_SIZE) in;
+
+// HALF_ACCUMULATION is defined by the host when the accumulation texture is RGBA16F
+#ifdef HALF_ACCUMULATION
+layout(rgba16f, binding = 0) uniform image2D u_accumulationImage;
+#else
+layout(rgba32f, binding = 0) uniform image2D u_accumulationImage;
+#endif
+
+// Feature buffers, only bound while the renderer keeps them
+layout(rgba32f, binding = 1) uniform image2D u_albedoImage;
+layout(rgba32f, binding = 2) uniform image2D u_normalDepthImage;
+
+// Next tile to hand out, reset to 0 by the host before every dispatch
+layout(std430, binding = 0) buffer TileQueue {
+	uint nextTile;
+};
+
+uniform ivec2 u_tileCount; // Of this dispatch, which may cover only some rows of tiles
+uniform int u_firstTileRow; // Tile row of the first tile
+uniform bool u_persistentThreads; // If true, each workgroup keeps fetching tiles instead of handling only gl_WorkGroupID
+
+shared uint s_tileIndex;
+
+void shadePixel(ivec2 pixel) {
+	ivec2 size = imageSize(u_accumulationImage);
+	if (pixel.x >= size.x || pixel.y >= size.y) return;
+
+	vec3 color = renderSample(pixel);
+
+	// Add last frame back (progressive sampling), in place. After camera motion the history is read from a
+	// copy of the previous accumulation, other tiles overwrite the image meanwhile.
+	if (u_reprojectHistory) {
+		imageStore(u_accumulationImage, pixel, accumulateReprojected(reprojectHistory(), color));
+	} else {
+		vec4 previous = (u_accumulatedPasses > 0) ? imageLoad(u_accumulationImage, pixel) : vec4(0.0);
+		imageStore(u_accumulationImage, pixel, accumulate(previous, color));
+	}
+
+	if (u_featureBuffers) {
+		imageStore(u_albedoImage, pixel, accumulateAlbedo(imageLoad(u_albedoImage, pixel), g_firstHitAlbedo));
+		imageStore(u_normalDepthImage, pixel, accumulateFeature(imageLoad(u_normalDepthImage, pixel), g_firstHitNormalDepth));
+	}
+}
+
+// A pixel checkerboard rendering skips this pass, see skippedPixelChanges()
+void keepPixel(ivec2 pixel) {
+	ivec2 size = imageSize(u_accumulationImage);
+	if (pixel.x >= size.x || pixel.y >= size.y) return;
+
+	if (skippedPixelTracesFirstHit()) traceFirstHit(pixel);
+	if (skippedPixelChanges()) imageStore(u_accumulationImage, pixel, skippedPixelHistory());
+	if (u_featureBuffers && u_featurePasses == 0) {
+		imageStore(u_albedoImage, pixel, g_firstHitAlbedo);
+		imageStore(u_normalDepthImage, pixel, g_firstHitNormalDepth);
+	}
+}
+
+void shadeTile(uint tileIndex) {
+	ivec2 tile = ivec2(tileIndex % uint(u_tileCount.x), tileIndex / uint(u_tileCount.x)) + ivec2(0, u_firstTileRow);
+	ivec2 local = ivec2(gl_LocalInvocationID.xy);
+	if (u_checkerboardParity < 0) {
+		shadePixel(tile * TILE_SIZE + local);
+		return;
+	}
+
+	// Checkerboard tiles are twice as wide, every invocation traces one pixel of a horizontal pair and
+	// keeps the other, so no invocation idles on a skipped pixel
+	ivec2 pair = ivec2(tile.x * 2 * TILE_SIZE + 2 * local.x, tile.y * TILE_SIZE + local.y);
+	int traced = (pair.y + u_checkerboardParity) & 1;
+	shadePixel(pair + ivec2(traced, 0));
+	keepPixel(pair + ivec2(1 - traced, 0));
+}
+
+// Hands the next tile index to the whole workgroup. Must be reached by every invocation.
+uint fetchTile() {
+	if (gl_LocalInvocationIndex == 0) s_tileIndex = atomicAdd(nextTile, 1u);
+	memoryBarrierShared();
+	barrier();
+	uint tileIndex = s_tileIndex;
+	// Everyone has to read the index before invocation 0 may fetch the next one
+	barrier();
+	return tileIndex;
+}
+
+void main() {
+	uint tileTotal = uint(u_tileCount.x * u_tileCount.y);
+
+	if (u_persistentThreads) {
+		for (uint tileIndex = fetchTile(); tileIndex < tileTotal; tileIndex = fetchTile()) {
+			shadeTile(tileIndex);
+		}
+	} else {
+		shadeTile(gl_WorkGroupID.y * uint(u_tileCount.x) + gl_WorkGroupID.x);
+	}
+}
@@ -0,0 +1,707 @@
+#version 430 core
+
+#define MAX_OBJECT_COUNT 64
+#define MAX_LIGHT_COUNT 4
+
+#define RENDER_DISTANCE 10000
+#define EPSILON 0.0001
+#define PI 3.1415926538
+#define OUTLINE_WIDTH 0.004
+#define OUTLINE_COLOR vec4(1.0, 0.0, 1.0, 1.0)
+// Reprojected history is dropped where the stored hit lies further from the plane of the new one than
+// this fraction of the depth, or the stored normal's cosine to the new one is below the second value:
+// the pixel saw another surface before
+#define REPROJECTION_DEPTH_TOLERANCE 0.02
+#define REPROJECTION_NORMAL_TOLERANCE 0.9
+
+struct Ray {
+	vec3 origin;
+	vec3 direction;
+};
+
+struct Material {
+	vec3 albedo;
+	vec3 specular;
+	vec3 emission;
+	float emissionStrength;
+	float roughness;
+	float specularHighlight;
+	float specularExponent;
+};
+
+struct SurfacePoint {
+	vec3 position;
+	vec3 normal;
+	Material material;
+	int objectIndex; // Into u_objects, -2 for the ground plane
+};
+
+struct Object {
+	uint type;
+	vec3 position;
+	vec3 scale;
+	Material material;
+};
+
+struct PointLight {
+	vec3 position;
+	float radius;
+	vec3 color;
+	float power;
+	float reach; // Only points within this distance of the light will be affected
+};
+
+uniform sampler2D u_screenTexture;
+uniform samplerCube u_skyboxTexture; // The sky's radiance, strength, gamma and ceiling already applied
+uniform bool u_skySampling; // If true, every bounce also sends a shadow ray towards the sky, picked with u_skySamplerTable
+uniform sampler2D u_skySamplerTable; // Alias table over the sky texels, see include/skysampler.h
+uniform samplerCube u_skyPrefiltered; // The sky averaged over specular lobes, rougher per mip level
+uniform int u_accumulatedPasses; // How many passes have been added to the texture
+uniform bool u_directOutputPass; // If this is true, the shader will draw the input texture directly to the screen. (Used to draw the contents of the FBO to the screen)
+uniform float u_time;
+uniform int u_sampleSeed; // Renderer::setSampleSeed(), 0 keeps the default sequence
+uniform bool u_debugKeyPressed;
+uniform int u_selectedSphereIndex;
+uniform bool u_runningAverage; // If true, the texture holds the mean of all passes instead of their sum (needed for RGBA16F)
+uniform ivec2 u_regionOffset; // Image pixel of the render target's pixel (0, 0), see Renderer::setImageRegion()
+uniform ivec2 u_imageSize; // Of the whole image, the render target may be one bucket of it
+uniform bool u_featureBuffers; // If true, the first hit of every pass is averaged into the feature buffers
+uniform int u_featurePasses; // How many passes the feature buffers hold
+uniform sampler2D u_normalDepthTexture; // Previous FEATURE_NORMAL_DEPTH, read while accumulating or reprojecting
+// If true, the camera moved since the last pass: this pass blends into the previous camera's accumulation,
+// reprojected through the first hit, instead of the pixel's own
+uniform bool u_reprojectHistory;
+uniform mat4 u_previousRotationMatrix;
+uniform vec3 u_previousCameraPosition;
+uniform int u_maxHistoryPasses; // Reprojected history counts as at most this many passes
+uniform int u_checkerboardParity; // -1 traces every pixel, 0 or 1 only the pixels whose x + y has that parity
+
+// Everything below only changes on user edits, so it lives in std140 uniform blocks that the host
+// re-uploads only when dirty. Layouts must match the Gpu* structs in src/renderer.cpp.
+layout(std140, binding = 0) uniform CameraBlock {
+	mat4 u_rotationMatrix;
+	vec3 u_cameraPosition;
+	float u_aspectRatio;
+};
+
+layout(std140, binding = 1) uniform SettingsBlock {
+	int u_shadowResolution;
+	int u_lightBounces;
+	int u_framePasses;
+	float u_blur;
+	float u_bloomRadius;
+	float u_bloomIntensity;
+	int u_skyCacheDepth; // Bounces from this depth on end in the sky's cached average, 0 traces them all
+	vec3 u_skyDiffuse[16]; // The sky as seen by a diffuse bounce in spherical harmonics, see include/skycube.h
+};
+
+layout(std140, binding = 2) uniform SceneBlock {
+	Object u_objects[MAX_OBJECT_COUNT];
+	PointLight u_lights[MAX_LIGHT_COUNT];
+	Material u_planeMaterial;
+	bool u_planeVisible;
+	int u_objectCount; // Only the first u_objectCount objects and u_lightCount lights are used
+	int u_lightCount;
+};
+
+// First hit of the camera ray in the last renderSample(), for the denoiser and the AOV outputs: albedo
+// with the object index in w, and the world normal with the distance along the ray in w. Rays that miss
+// get albedo 1, object index -1, normal 0 and RENDER_DISTANCE. g_firstHitPosition is the hit in world space.
+vec4 g_firstHitAlbedo;
+vec4 g_firstHitNormalDepth;
+vec3 g_firstHitPosition;
+
+// PCG integer hash (Jarzynski and Olano 2020)
+uint hashUint(uint value) {
+	uint state = value * 747796405u + 2891336453u;
+	uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+// With a sample seed, the input's bits are hashed together with the seed instead of going through the
+// sine, so every seed gets a sequence of its own however many samples u_time counts
+float rand(vec2 co){
+    if (u_sampleSeed == 0) return fract(sin(dot(co, vec2(12.9898, 78.233))) * 43758.5453);
+    uint key = hashUint(floatBitsToUint(co.x) ^ hashUint(floatBitsToUint(co.y) ^ hashUint(uint(u_sampleSeed))));
+    return float(hashUint(key) >> 8u) / 16777216.0;
+}
+
+// Three uniform numbers in [0, 1) for a point and seed, with all 24 bits of precision. rand() only has
+// a few good bits after scaling its sine by 43758, too few to pick one texel among thousands.
+vec3 rand3(vec3 position, float seed, int depth) {
+	uint key = hashUint(floatBitsToUint(position.x) ^ hashUint(floatBitsToUint(position.y) ^
+	           hashUint(floatBitsToUint(position.z) ^ hashUint(floatBitsToUint(seed) + uint(depth)))));
+	if (u_sampleSeed != 0) key = hashUint(key ^ uint(u_sampleSeed));
+	uvec3 bits = uvec3(hashUint(key), hashUint(key + 1u), hashUint(key + 2u)) >> 8u;
+	return vec3(bits) / 16777216.0;
+}
+
+bool sphereIntersection(vec3 position, float radius, Ray ray, out float hitDistance){
+    float t = dot(position - ray.origin, ray.direction);
+	vec3 p = ray.origin + ray.direction * t;
+
+	float y = length(position - p);
+	if (y < radius) { 
+		float x =  sqrt(radius*radius - y*y);
+		float t1 = t-x;
+		if (t1 >  0) {
+			hitDistance = t1;
+			return true;
+		}
+
+	}
+	
+	return false;
+}
+
+bool boxIntersection(vec3 position, vec3 size, Ray ray, out float hitDistance) {
+	float t1 = -1000000000000.0;
+    float t2 = 1000000000000.0;
+
+	vec3 boxMin = position - size / 2.0;
+	vec3 boxMax = position + size / 2.0;
+
+    vec3 t0s = (boxMin - ray.origin) / ray.direction;
+    vec3 t1s = (boxMax - ray.origin) / ray.direction;
+
+    vec3 tsmaller = min(t0s, t1s);
+    vec3 tbigger = max(t0s, t1s);
+
+    t1 = max(t1, max(tsmaller.x, max(tsmaller.y, tsmaller.z)));
+    t2 = min(t2, min(tbigger.x, min(tbigger.y, tbigger.z)));
+
+	hitDistance = t1;
+
+    return t1 >= 0 && t1 <= t2;
+}
+
+vec3 boxNormal(vec3 cubePosition, vec3 size, vec3 surfacePosition)
+{
+    // Source: https://gist.github.com/Shtille/1f98c649abeeb7a18c5a56696546d3cf
+    // step(edge,x) : x < edge ? 0 : 1
+
+	vec3 boxMin = cubePosition - size / 2.0;
+	vec3 boxMax = cubePosition + size / 2.0;
+
+	vec3 center = (boxMax + boxMin) * 0.5;
+	vec3 boxSize = (boxMax - boxMin) * 0.5;
+	vec3 pc = surfacePosition - center;
+	// step(edge,x) : x < edge ? 0 : 1
+	vec3 normal = vec3(0.0);
+	normal += vec3(sign(pc.x), 0.0, 0.0) * step(abs(abs(pc.x) - boxSize.x), EPSILON);
+	normal += vec3(0.0, sign(pc.y), 0.0) * step(abs(abs(pc.y) - boxSize.y), EPSILON);
+	normal += vec3(0.0, 0.0, sign(pc.z)) * step(abs(abs(pc.z) - boxSize.z), EPSILON);
+	return normalize(normal);
+}
+
+bool planeIntersection(vec3 planeNormal, vec3 planePoint, Ray ray, out float hitDistance) 
+{ 
+    float denom = dot(planeNormal, ray.direction); 
+    if (abs(denom) > EPSILON) { 
+        vec3 d = planePoint - ray.origin; 
+        hitDistance = dot(d, planeNormal) / denom; 
+        return (hitDistance >= EPSILON); 
+    } 
+ 
+    return false; 
+} 
+
+bool raycast(Ray ray, out SurfacePoint hitPoint) {
+	bool didHit = false;
+	float minHitDist = RENDER_DISTANCE;
+
+	float hitDist;
+	for (int i = 0; i<u_objectCount; i++) {
+		if (u_objects[i].type == 0) continue;
+
+		if (u_objects[i].type == 1 && sphereIntersection(u_objects[i].position, u_objects[i].scale.x, ray, hitDist)) {
+			didHit = true;
+			if (hitDist < minHitDist) {
+				minHitDist = hitDist;
+				hitPoint.position = ray.origin + ray.direction * minHitDist;
+				hitPoint.normal = normalize(hitPoint.position - u_objects[i].position);
+				hitPoint.material = u_objects[i].material;
+				hitPoint.objectIndex = i;
+			}
+		}
+
+		if (u_objects[i].type == 2 && boxIntersection(u_objects[i].position, u_objects[i].scale, ray, hitDist)) {
+			didHit = true;
+			if (hitDist < minHitDist) {
+				minHitDist = hitDist;
+				hitPoint.position = ray.origin + ray.direction * minHitDist;
+				hitPoint.normal = boxNormal(u_objects[i].position, u_objects[i].scale, ray.origin + ray.direction * minHitDist);
+				hitPoint.material = u_objects[i].material;
+				hitPoint.objectIndex = i;
+			}
+		}
+	}
+
+	if (u_planeVisible && planeIntersection(vec3(0,1,0), vec3(0, 0, 0), ray, hitDist)) {
+		didHit = true;
+		if (hitDist < minHitDist) {
+			minHitDist = hitDist;
+			hitPoint.position = ray.origin + ray.direction * minHitDist;
+			hitPoint.normal = vec3(0,1,0);
+			hitPoint.material = u_planeMaterial;
+			hitPoint.objectIndex = -2;
+		}
+	}
+
+	return didHit;
+}
+
+// Adapted from https://bitbucket.org/Daerst/gpu-ray-tracing-in-unity/src/Tutorial_Pt2/Assets/RayTracingShader.compute
+mat3x3 getTangentSpace(vec3 normal)
+{
+    // Choose a helper vector for the cross product
+    vec3 helper = vec3(1, 0, 0);
+    if (abs(normal.x) > 0.99)
+        helper = vec3(0, 0, 1);
+
+    // Generate vectors
+    vec3 tangent = normalize(cross(normal, helper));
+    vec3 binormal = normalize(cross(normal, tangent));
+    return mat3x3(tangent, binormal, normal);
+}
+
+// Basic rejection sampling method
+vec3 _sampleHemisphere(vec3 normal, vec2 seed)
+{
+    vec3 vec = normalize(vec3(rand(seed)*2.0-1.0,rand(seed.yx+vec2(1.123123123,2.545454))*2.0-1.0,rand(seed-vec2(9.21428,7.43163431))*2.0-1.0));
+	if (dot(vec, normal) < 0.0) vec *= -1; 
+
+	return vec;
+}
+
+// Adapted from https://bitbucket.org/Daerst/gpu-ray-tracing-in-unity/src/Tutorial_Pt2/Assets/RayTracingShader.compute
+vec3 sampleHemisphere(vec3 normal, float alpha, vec2 seed)
+{
+    // Sample the hemisphere, where alpha determines the kind of the sampling
+    float cosTheta = pow(rand(seed), 1.0 / (alpha + 1.0));
+    float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+    float phi = 2 * PI * rand(seed.yx);
+    vec3 tangentSpaceDir = vec3(cos(phi) * sinTheta, sin(phi) * sinTheta, cosTheta);
+
+    // Transform direction to world space
+    return getTangentSpace(normal) * tangentSpaceDir;
+}
+
+// Always from the top mip level: implicit derivatives between neighbouring bounce rays are meaningless,
+// and sky samples and bounces have to see the same radiance
+vec3 sampleSkybox(vec3 dir) {
+	return textureLod(u_skyboxTexture, dir, 0.0).rgb;
+}
+
+// Must match SKY_PREFILTER_LEVELS in src/renderer.cpp
+const int SKY_PREFILTER_LEVELS = 6;
+
+// The sky's radiance averaged over the specular lobe of the given roughness around dir
+vec3 prefilteredSky(vec3 dir, float roughness) {
+	return textureLod(u_skyPrefiltered, dir, roughness * float(SKY_PREFILTER_LEVELS - 1)).rgb;
+}
+
+// What a diffuse bounce off a surface facing normal brings back from the sky on average, ignoring
+// anything in the way: the sky weighted by the cosine squared, in the basis of projectSkyDiffuse()
+vec3 skyDiffuse(vec3 normal) {
+	float x = normal.x, y = normal.y, z = normal.z;
+	vec3 result = 0.282095 * u_skyDiffuse[0];
+	result += 0.488603 * (y * u_skyDiffuse[1] + z * u_skyDiffuse[2] + x * u_skyDiffuse[3]);
+	result += 1.092548 * (x * y * u_skyDiffuse[4] + y * z * u_skyDiffuse[5] + x * z * u_skyDiffuse[7]);
+	result += 0.315392 * (3.0 * z * z - 1.0) * u_skyDiffuse[6];
+	result += 0.546274 * (x * x - y * y) * u_skyDiffuse[8];
+	result += 0.590044 * y * (3.0 * x * x - y * y) * u_skyDiffuse[9];
+	result += 2.890611 * x * y * z * u_skyDiffuse[10];
+	result += 0.457046 * (5.0 * z * z - 1.0) * (y * u_skyDiffuse[11] + x * u_skyDiffuse[13]);
+	result += 0.373176 * z * (5.0 * z * z - 3.0) * u_skyDiffuse[12];
+	result += 1.445306 * z * (x * x - y * y) * u_skyDiffuse[14];
+	result += 0.590044 * x * (x * x - 3.0 * y * y) * u_skyDiffuse[15];
+	return max(result, vec3(0.0));
+}
+
+// Picks a sky direction with a probability proportional to the sky's radiance from u_skySamplerTable:
+// a texel in constant time, then a uniform point of the texel's rectangle in the equirectangular image.
+// Returns the density over solid angle in pdf, the same as skyDirectionPdf() gives.
+vec3 sampleSkyDirection(vec3 random, out float pdf) {
+	ivec2 size = textureSize(u_skySamplerTable, 0);
+	int count = size.x * size.y;
+	float slot = random.x * float(count);
+	int index = min(int(slot), count - 1);
+	vec4 entry = texelFetch(u_skySamplerTable, ivec2(index % size.x, index / size.x), 0);
+	if (slot - float(index) >= entry.r) {
+		index = int(entry.g);
+		entry = texelFetch(u_skySamplerTable, ivec2(index % size.x, index / size.x), 0);
+	}
+
+	vec2 uv = (vec2(index % size.x, index / size.x) + random.yz) / vec2(size);
+	float theta = uv.y * PI;
+	float phi = (uv.x - 0.5) * 2 * PI;
+	float sinTheta = sin(theta);
+	// The image's texels span 2 PI^2 sin(theta) of solid angle per unit of uv area
+	pdf = entry.b / (2 * PI * PI * max(sinTheta, EPSILON));
+	return vec3(sinTheta * sin(phi), cos(theta), sinTheta * cos(phi));
+}
+
+// Density over solid angle of sampleSkyDirection() returning dir
+float skyDirectionPdf(vec3 dir) {
+	ivec2 size = textureSize(u_skySamplerTable, 0);
+	vec2 uv = vec2(0.5 + atan(dir.x, dir.z)/(2*PI), 0.5 + asin(-dir.y)/PI);
+	ivec2 texel = clamp(ivec2(uv * vec2(size)), ivec2(0), size - ivec2(1));
+	float sinTheta = sqrt(max(1.0 - dir.y * dir.y, 0.0));
+	return texelFetch(u_skySamplerTable, texel, 0).b / (2 * PI * PI * max(sinTheta, EPSILON));
+}
+
+// What a bounce from point towards dir is worth on average: the energy factor of each lobe times the
+// chance of picking the lobe and its density of picking dir, summed. The summed density goes to pdf.
+// Mirrors pick a single direction that sky samples never hit, they're left out.
+vec3 bounceWeight(SurfacePoint point, vec3 incoming, vec3 dir, float specChance, float diffChance, out float pdf) {
+	float cosine = dot(point.normal, dir);
+	vec3 weight = vec3(0.0);
+	pdf = 0.0;
+	if (diffChance > 0.0) {
+		// sampleHemisphere() with alpha 1 is cosine weighted
+		float diffusePdf = max(cosine, 0.0) / PI;
+		weight += diffChance * diffusePdf * point.material.albedo * clamp(cosine, 0.0, 1.0);
+		pdf += diffChance * diffusePdf;
+	}
+	float smoothness = 1.0 - point.material.roughness;
+	if (specChance > 0.0 && smoothness < 1.0) {
+		float alpha = pow(1000.0, smoothness*smoothness);
+		float specularPdf = (alpha + 1) / (2 * PI) * pow(max(dot(reflect(incoming, point.normal), dir), 0.0), alpha);
+		float f = (alpha + 2) / (alpha + 1);
+		weight += specChance * specularPdf * point.material.specular * clamp(cosine * f, 0.0, 1.0);
+		pdf += specChance * specularPdf;
+	}
+	return weight;
+}
+
+// Light from a sky direction picked by sampleSkyDirection(), if nothing blocks it. Weighted with the
+// power heuristic against a bounce escaping in the same direction, which computeSceneColor() weights
+// the other way, so bright, small parts of the sky (a sun) are found by sky samples and broad ones
+// mostly by bounces. After the last bounce no ray escapes, the sky sample then counts fully.
+vec3 sampleSkyLight(SurfacePoint point, vec3 incoming, float specChance, float diffChance, bool lastBounce, vec3 random) {
+	float skyPdf;
+	vec3 dir = sampleSkyDirection(random, skyPdf);
+	if (skyPdf <= 0.0 || dot(point.normal, dir) <= 0.0) return vec3(0.0);
+
+	float bouncePdf;
+	vec3 weight = bounceWeight(point, incoming, dir, specChance, diffChance, bouncePdf);
+	if (weight == vec3(0.0)) return vec3(0.0);
+	if (lastBounce) bouncePdf = 0.0;
+	SurfacePoint blocker;
+	if (raycast(Ray(point.position + point.normal * EPSILON, dir), blocker)) return vec3(0.0);
+	return weight * sampleSkybox(dir) * skyPdf / (skyPdf * skyPdf + bouncePdf * bouncePdf);
+}
+
+// Adds up the total light received directly from all light sources
+vec3 computeDirectIllumination(SurfacePoint point, vec3 observerPos, float seed) {
+	vec3 directIllumination = vec3(0);
+
+	for (int lightIndex = 0; lightIndex<u_lightCount; lightIndex++) {
+		PointLight light = u_lights[lightIndex];
+			
+		float lightDistance = length(light.position - point.position);
+		if (lightDistance > light.reach) continue;
+
+		float diffuse = clamp(dot(point.normal, normalize(light.position-point.position)), 0.0, 1.0);
+
+		if (diffuse > EPSILON || point.material.roughness < 1.0) {
+			// Shadow raycasting
+			int shadowRays = int(u_shadowResolution*light.radius*light.radius/(lightDistance*lightDistance)+1); // There must be a better way to find the right amount of shadow rays
+			int shadowRayHits = 0;
+			for (int i = 0; i<shadowRays; i++) {
+				// Sample a point on the light sphere
+				
+				vec3 lightSurfacePoint = light.position + normalize(vec3(rand(vec2(i+seed, 1)+point.position.xy), rand(vec2(i+seed, 2)+point.position.yz), rand(vec2(i+seed, 3)+point.position.xz))) * light.radius;
+				vec3 lightDir = normalize(lightSurfacePoint - point.position);
+				vec3 rayOrigin = point.position + lightDir * EPSILON * 2.0;
+				float maxRayLength = length(lightSurfacePoint - rayOrigin);
+				Ray shadowRay = Ray(rayOrigin, lightDir);
+				SurfacePoint SR_hit;
+				if (raycast(shadowRay, SR_hit)) {
+					if (length(SR_hit.position-rayOrigin) < maxRayLength) {
+						shadowRayHits += 1;
+					}
+				}
+
+			}
+
+			// Diffuse 
+			float attenuation = lightDistance * lightDistance;
+			directIllumination += light.color * light.power * diffuse * point.material.albedo * (1.0-float(shadowRayHits)/shadowRays) / attenuation;
+		
+			// Specular highlight
+			vec3 lightDir = normalize(point.position - light.position);
+			vec3 reflectedLightDir = reflect(lightDir, point.normal);
+			vec3 cameraDir = normalize(observerPos - point.position);
+			directIllumination += point.material.specularHighlight * light.color * (light.power/(lightDistance*lightDistance)) * pow(max(dot(cameraDir, reflectedLightDir), 0.0), 1.0/max(point.material.specularExponent, EPSILON));
+	
+		}
+	}
+
+	return directIllumination;
+}
+
+// Based on https://bitbucket.org/Daerst/gpu-ray-tracing-in-unity/src/Tutorial_Pt2/Assets/RayTracingShader.compute
+vec3 computeSceneColor(Ray cameraRay, float seed) {
+	vec3 totalIllumination = vec3(0);
+	vec3 rayOrigin = cameraRay.origin;
+	vec3 rayDirection = cameraRay.direction;
+	vec3 energy = vec3(1.0);
+	float bouncePdf = -1.0; // Of the last bounce direction, see bounceWeight(). Negative for camera rays and mirrors.
+	for (int depth = 0; depth < u_lightBounces; depth++) {
+		SurfacePoint hitPoint;
+		if (raycast(Ray(rayOrigin, rayDirection), hitPoint)) {
+			if (depth == 0) {
+				g_firstHitAlbedo = vec4(hitPoint.material.albedo, float(hitPoint.objectIndex));
+				g_firstHitNormalDepth = vec4(hitPoint.normal, length(hitPoint.position - rayOrigin));
+				g_firstHitPosition = hitPoint.position;
+			}
+
+			// Part one: Hit object's emission
+			totalIllumination += energy * hitPoint.material.emission * hitPoint.material.emissionStrength;
+
+			// Part two: Direct light (received directly from light sources)
+			totalIllumination += energy * computeDirectIllumination(hitPoint, rayOrigin, seed);
+
+			// Part three: Indirect light (other objects + skybox)
+			float specChance = dot(hitPoint.material.specular, vec3(1.0/3.0));
+			float diffChance = dot(hitPoint.material.albedo, vec3(1.0/3.0));
+
+			float sum = specChance + diffChance;
+			specChance /= sum;
+			diffChance /= sum;
+
+			// Deep diffuse and rough bounces see a smooth blur of the sky, the path can end with its cached
+			// average over the picked lobe. Mirrors keep tracing, they see the sky sharply.
+			bool cacheSky = u_skyCacheDepth > 0 && depth >= u_skyCacheDepth && (specChance == 0.0 || hitPoint.material.roughness > 0.0);
+			vec3 pathEnergy = energy;
+			vec3 cachedSky = vec3(0.0);
+
+			// Part two and a half: Sky light, aimed at where the sky is bright. The cached average has it already.
+			if (u_skySampling && !cacheSky) {
+				totalIllumination += energy * sampleSkyLight(hitPoint, rayDirection, specChance, diffChance, depth == u_lightBounces - 1,
+				                                          rand3(hitPoint.position, seed, depth));
+			}
+
+			// Roulette-select the ray's path
+			vec3 incoming = rayDirection;
+			bool mirrored = false;
+			float roulette = rand(hitPoint.position.zx+vec2(hitPoint.position.y)+vec2(seed, depth));
+			if (roulette < specChance)
+			{
+				// Specular reflection
+				float smoothness = 1.0-hitPoint.material.roughness;
+				float alpha = pow(1000.0, smoothness*smoothness);
+				if (smoothness == 1.0) {
+					mirrored = true;
+					rayDirection = reflect(rayDirection, hitPoint.normal);
+				} else {
+					rayDirection = sampleHemisphere(reflect(rayDirection, hitPoint.normal), alpha, hitPoint.position.zx+vec2(hitPoint.position.y)+vec2(seed, depth));
+				}
+				rayOrigin = hitPoint.position + rayDirection * EPSILON;
+				float f = (alpha + 2) / (alpha + 1);
+				energy *= hitPoint.material.specular * clamp(dot(hitPoint.normal, rayDirection) * f, 0.0, 1.0);
+				if (cacheSky) {
+					vec3 reflected = reflect(incoming, hitPoint.normal);
+					cachedSky = hitPoint.material.specular * clamp(dot(hitPoint.normal, reflected) * f, 0.0, 1.0) *
+					            prefilteredSky(reflected, hitPoint.material.roughness);
+				}
+			}
+			else if (diffChance > 0 && roulette < specChance + diffChance)
+			{
+				// Diffuse reflection
+				rayOrigin = hitPoint.position + hitPoint.normal * EPSILON;
+				rayDirection = sampleHemisphere(hitPoint.normal, 1.0, hitPoint.position.zx+vec2(hitPoint.position.y)+vec2(seed, depth));
+				energy *= hitPoint.material.albedo * clamp(dot(hitPoint.normal, rayDirection), 0.0, 1.0);
+				if (cacheSky) cachedSky = hitPoint.material.albedo * skyDiffuse(hitPoint.normal);
+			} else {
+				// This means both the hit material's albedo and specular are totally black, so there won't be anymore light. We can stop here.
+				break;
+			}
+			if (cacheSky) {
+				// The picked direction still has to reach the sky, so enclosed places stay dark
+				SurfacePoint blocker;
+				if (!raycast(Ray(rayOrigin, rayDirection), blocker)) totalIllumination += pathEnergy * cachedSky;
+				break;
+			}
+			bouncePdf = -1.0;
+			if (u_skySampling && !mirrored) bounceWeight(hitPoint, incoming, rayDirection, specChance, diffChance, bouncePdf);
+		} else {
+			// The ray didn't hit anything, so we add the sky's color and we're done
+			vec3 sky = energy * sampleSkybox(rayDirection);
+			if (u_skySampling && bouncePdf > 0.0) {
+				// The sky samples of the last hit could have found this direction too, see sampleSkyLight()
+				float skyPdf = skyDirectionPdf(rayDirection);
+				sky *= bouncePdf * bouncePdf / (bouncePdf * bouncePdf + skyPdf * skyPdf);
+			}
+			totalIllumination += sky;
+			break;
+		}
+	}
+
+	return totalIllumination;
+}
+
+
+// Image uv through the center of a render target pixel. It's computed from the integer image pixel alone,
+// so it comes out bit for bit the same whichever bucket renders the pixel, and so do the camera ray and
+// every random number seeded with it.
+vec2 pixelUV(ivec2 targetPixel) {
+	return (vec2(u_regionOffset + targetPixel) + vec2(0.5)) / vec2(u_imageSize);
+}
+
+// Traces one pass (u_framePasses samples) through the given render target pixel. Shared by the fragment and compute backends.
+vec3 renderSample(ivec2 targetPixel) {
+	vec2 uv = pixelUV(targetPixel);
+	vec2 centeredUV = (uv * 2 - vec2(1)) * vec2(u_aspectRatio, 1.0);
+
+	if (u_blur > 0.0 && u_accumulatedPasses > 0) centeredUV += vec2(rand(vec2(1, u_time)+uv.xy)*u_blur-u_blur/2, rand(vec2(2, u_time)+uv.yx)*u_blur-u_blur/2);
+	vec3 rayDir = (normalize(vec4(centeredUV, -1.0, 0.0)) * u_rotationMatrix).xyz;
+	Ray cameraRay = Ray(u_cameraPosition, rayDir);
+
+	g_firstHitAlbedo = vec4(vec3(1.0), -1.0);
+	g_firstHitNormalDepth = vec4(vec3(0.0), RENDER_DISTANCE);
+	g_firstHitPosition = cameraRay.origin + cameraRay.direction * RENDER_DISTANCE;
+
+	// Camera raycasting
+	vec3 colorSum = computeSceneColor(cameraRay, u_time);
+	for (int i = 0; i<u_framePasses-1; i++) colorSum += computeSceneColor(cameraRay, u_time+i);
+	vec3 color = colorSum / u_framePasses;
+
+	if (u_accumulatedPasses > 0) {
+		// Bloom
+		SurfacePoint hitPoint;
+		vec3 offsetDirection = cameraRay.direction + vec3(rand(vec2(1, u_time)+uv)*u_bloomRadius-u_bloomRadius/2, rand(vec2(2, u_time)+uv)*u_bloomRadius-u_bloomRadius/2, rand(vec2(3, u_time)+uv)*u_bloomRadius-u_bloomRadius/2);
+		if (raycast(Ray(cameraRay.origin, offsetDirection), hitPoint)) {
+			color += hitPoint.material.emission*hitPoint.material.emissionStrength*u_bloomIntensity;
+		}
+	}
+
+	return color;
+}
+
+// Finds the first hit through a render target pixel like renderSample() does, without shading it
+void traceFirstHit(ivec2 targetPixel) {
+	vec2 uv = pixelUV(targetPixel);
+	vec2 centeredUV = (uv * 2 - vec2(1)) * vec2(u_aspectRatio, 1.0);
+	Ray cameraRay = Ray(u_cameraPosition, (normalize(vec4(centeredUV, -1.0, 0.0)) * u_rotationMatrix).xyz);
+
+	SurfacePoint hitPoint;
+	if (raycast(cameraRay, hitPoint)) {
+		g_firstHitAlbedo = vec4(hitPoint.material.albedo, float(hitPoint.objectIndex));
+		g_firstHitNormalDepth = vec4(hitPoint.normal, length(hitPoint.position - cameraRay.origin));
+		g_firstHitPosition = hitPoint.position;
+	} else {
+		g_firstHitAlbedo = vec4(vec3(1.0), -1.0);
+		g_firstHitNormalDepth = vec4(vec3(0.0), RENDER_DISTANCE);
+		g_firstHitPosition = cameraRay.origin + cameraRay.direction * RENDER_DISTANCE;
+	}
+}
+
+// Combines a new pass with what's already in the accumulation texture. Alpha counts the pixel's passes,
+// which differ from pixel to pixel once the camera moved with reprojection.
+vec4 accumulate(vec4 previous, vec3 color) {
+	if (u_accumulatedPasses == 0) return vec4(color, 1.0);
+
+	// Blending with weight 1/n keeps the values in the range of a single pass, so half floats don't overflow.
+	// Half float counts stop at 2048, from there on every pass is blended in with weight 1/2049.
+	if (u_runningAverage) return vec4(mix(previous.rgb, color, 1.0 / (previous.a + 1.0)), previous.a + 1.0);
+	return previous + vec4(color, 1.0);
+}
+
+// Looks up the first hit of the last renderSample() in the previous camera's accumulation (u_screenTexture)
+// and returns the average radiance there, with its pass count in alpha, capped at u_maxHistoryPasses so
+// resampled and view-dependent history fades out quickly. Texels of the bilinear footprint whose stored
+// depth or normal don't match saw another surface and are left out (disocclusion); with none left, or
+// where the hit was outside the previous view, the pass count is 0.
+vec4 reprojectHistory() {
+	vec3 toHit = g_firstHitPosition - u_previousCameraPosition;
+	float expectedDepth = length(toHit);
+	// World to camera is the transpose of the camera to world rotation, which vec * matrix applies
+	vec3 cameraDirection = (u_previousRotationMatrix * vec4(toHit / expectedDepth, 0.0)).xyz;
+	if (cameraDirection.z > -EPSILON) return vec4(0.0);
+	vec2 centeredUV = cameraDirection.xy / -cameraDirection.z;
+	vec2 imageUV = (centeredUV / vec2(u_aspectRatio, 1.0) + vec2(1.0)) * 0.5;
+
+	ivec2 size = textureSize(u_screenTexture, 0);
+	vec2 texel = imageUV * vec2(u_imageSize) - vec2(u_regionOffset) - vec2(0.5);
+	ivec2 base = ivec2(floor(texel));
+	vec2 fraction = texel - vec2(base);
+	vec3 normal = g_firstHitNormalDepth.xyz;
+	bool missed = dot(normal, normal) == 0.0;
+	vec4 sum = vec4(0.0);
+	float weightSum = 0.0;
+	for (int i = 0; i < 4; i++) {
+		ivec2 offset = ivec2(i & 1, i >> 1);
+		ivec2 tap = base + offset;
+		if (any(lessThan(tap, ivec2(0))) || any(greaterThanEqual(tap, size))) continue;
+
+		vec4 tapNormalDepth = texelFetch(u_normalDepthTexture, tap, 0);
+		if (missed) {
+			// Sky stays sky: only other misses have the same depth
+			if (abs(tapNormalDepth.w - expectedDepth) > REPROJECTION_DEPTH_TOLERANCE * expectedDepth) continue;
+		} else {
+			// Distance to the plane rather than along the ray, which changes a lot within a pixel at grazing angles
+			vec2 tapCenteredUV = (pixelUV(tap) * 2 - vec2(1)) * vec2(u_aspectRatio, 1.0);
+			vec3 tapDirection = (normalize(vec4(tapCenteredUV, -1.0, 0.0)) * u_previousRotationMatrix).xyz;
+			vec3 tapPosition = u_previousCameraPosition + tapDirection * tapNormalDepth.w;
+			if (abs(dot(tapPosition - g_firstHitPosition, normal)) > REPROJECTION_DEPTH_TOLERANCE * expectedDepth) continue;
+			if (dot(tapNormalDepth.xyz, normal) < REPROJECTION_NORMAL_TOLERANCE * length(tapNormalDepth.xyz)) continue;
+		}
+
+		vec4 history = texelFetch(u_screenTexture, tap, 0);
+		if (!u_runningAverage) history.rgb /= max(history.a, 1.0);
+		vec2 bilinear = mix(vec2(1.0) - fraction, fraction, vec2(offset));
+		float weight = bilinear.x * bilinear.y;
+		sum += weight * history;
+		weightSum += weight;
+	}
+	if (weightSum <= 0.0) return vec4(0.0);
+	vec4 history = sum / weightSum;
+	return vec4(history.rgb, min(floor(history.a), float(u_maxHistoryPasses)));
+}
+
+// accumulate() for a reprojected history as returned by reprojectHistory()
+vec4 accumulateReprojected(vec4 history, vec3 color) {
+	float passes = history.a + 1.0;
+	vec3 average = mix(history.rgb, color, 1.0 / passes);
+	return u_runningAverage ? vec4(average, passes) : vec4(average * passes, passes);
+}
+
+// Feature buffers always hold the running average, whatever the accumulation mode
+vec4 accumulateFeature(vec4 previous, vec4 value) {
+	// With checkerboard rendering a pixel is traced on every other pass, the first of them writes the value
+	int passes = u_checkerboardParity >= 0 ? u_featurePasses / 2 : u_featurePasses;
+	if (passes == 0) return value;
+	return mix(previous, value, 1.0 / float(passes + 1));
+}
+
+// Object indices can't be averaged, the albedo buffer keeps the one of the latest pass
+vec4 accumulateAlbedo(vec4 previous, vec4 value) {
+	return vec4(accumulateFeature(previous, value).rgb, value.w);
+}
+
+// Checkerboard rendering traces every other pixel per pass, alternating between the two parities
+bool checkerboardSkipped(ivec2 pixel) {
+	return u_checkerboardParity >= 0 && ((pixel.x + pixel.y) & 1) != u_checkerboardParity;
+}
+
+// A skipped pixel keeps its accumulation and features, except on the first pass after a reset, when it has
+// none yet, and after camera motion, when its history is reprojected without adding a pass
+bool skippedPixelChanges() {
+	return u_accumulatedPasses == 0 || u_reprojectHistory;
+}
+
+// Skipped pixels only trace their first hit, to reproject the history or to start the features over
+bool skippedPixelTracesFirstHit() {
+	return u_reprojectHistory || (u_featureBuffers && u_featurePasses == 0);
+}
+
+// Accumulation of a skipped pixel where skippedPixelChanges(), after traceFirstHit(). Without a pass or
+// reprojected history the pass count is 0 and present() fills the pixel in from its neighbours.
+vec4 skippedPixelHistory() {
+	if (!u_reprojectHistory) return vec4(0.0);
+	vec4 history = reprojectHistory();
+	return u_runningAverage ? history : vec4(history.rgb * history.a, history.a);
+}
@@ -0,0 +1,558 @@
+#include <glad/glad.h>
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "checkpoint.h"
+#include "context.h"
+#include "denoiser.h"
+#include "distributed.h"
+#include "image.h"
+#include "renderer.h"
+#include "scene.h"
+#include "texturecache.h"
+#include "textureloader.h"
+
+// Rows read back from the GPU and handed to the image writer at a time
+static const int BAND_ROWS = 64;
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static const char* backendName(RenderBackend backend) {
+    return backend == BACKEND_COMPUTE ? "compute" : "fragment";
+}
+
+static std::unique_ptr<Renderer> createRenderer(int width, int height, RenderBackend backend, const Scene& scene, const Camera& camera,
+                                                TextureLoader& textureLoader, bool featureBuffers = false) {
+    std::unique_ptr<Renderer> renderer(new Renderer(width, height, backend));
+    renderer->setFeatureBuffers(featureBuffers);
+    renderer->setTextureLoader(&textureLoader);
+    if (!renderer->init()) return NULL;
+    renderer->setScene(scene);
+    renderer->setCamera(camera);
+    return renderer;
+}
+
+// Side of the window at the center of the frame that createFastestRenderer() times the backends on
+static const int PROBE_SIZE = 256;
+
+// Times one pass of each backend over a PROBE_SIZE window of the frame, after a warm-up pass that absorbs
+// shader compilation and first-use costs, then creates the full-size renderer with the faster one. Only
+// one renderer exists at a time, and the probes' passes cost a fraction of full ones on large frames.
+static std::unique_ptr<Renderer> createFastestRenderer(int width, int height, const Scene& scene, const Camera& camera,
+                                                       TextureLoader& textureLoader, bool featureBuffers = false) {
+    int probeWidth = std::min(width, PROBE_SIZE);
+    int probeHeight = std::min(height, PROBE_SIZE);
+    bool found = false;
+    RenderBackend bestBackend = BACKEND_FRAGMENT;
+    double bestSeconds = 0.0;
+    const RenderBackend backends[2] = {BACKEND_FRAGMENT, BACKEND_COMPUTE};
+    for (int i = 0; i < 2; ++i) {
+        std::unique_ptr<Renderer> probe = createRenderer(probeWidth, probeHeight, backends[i], scene, camera, textureLoader, featureBuffers);
+        if (!probe) continue;
+        probe->setReportTextureErrors(false);
+        probe->setImageRegion(width, height, (width - probeWidth) / 2, (height - probeHeight) / 2);
+
+        probe->renderPass();
+        glFinish();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        probe->renderPass();
+        glFinish();
+        double seconds = secondsSince(start);
+        std::cout << backendName(backends[i]) << " backend: " << seconds * 1000.0 << " ms per " << probeWidth << "x" << probeHeight
+                  << " pass\n";
+
+        if (!found || seconds < bestSeconds) {
+            found = true;
+            bestBackend = backends[i];
+            bestSeconds = seconds;
+        }
+    }
+    if (!found) return NULL;
+    return createRenderer(width, height, bestBackend, scene, camera, textureLoader, featureBuffers);
+}
+
+// Pixels rendered around each bucket and dropped on write, so the denoiser sees the real image at
+// bucket borders. Without denoising no pass reads neighbouring pixels.
+static int bucketApron(bool denoise) {
+    return denoise ? denoiseReach(defaultDenoiseSettings()) : 0;
+}
+
+struct RenderStats {
+    double renderSeconds;
+    double writeSeconds;
+    double denoiseSeconds;
+    double pixelPasses; // Sum of the passes of all written pixels
+    double resumedPixelPasses; // The part of pixelPasses that came from a checkpoint
+    int minPasses;
+    int maxPasses;
+};
+
+// Set by SIGTERM/SIGINT while checkpointing, so a preempted job can save its state before exiting
+static volatile std::sig_atomic_t s_stopRequested = 0;
+
+static void requestStop(int) {
+    s_stopRequested = 1;
+}
+
+// Adds passes until there are targetPasses (0 = no target) or another pass of the average length would
+// overrun timeBudget seconds (0 = no limit). Waiting for every pass keeps the budget exact and the driver
+// queue short. With a checkpoint, one is started every checkpointInterval seconds and written between passes.
+static double accumulatePasses(Renderer& renderer, int targetPasses, double timeBudget,
+                               Checkpoint* checkpoint = NULL, double checkpointInterval = 0.0) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    double seconds = 0.0;
+    double lastCheckpoint = 0.0;
+    int firstPass = renderer.accumulatedPasses();
+    while ((targetPasses == 0 || renderer.accumulatedPasses() < targetPasses) && !s_stopRequested) {
+        renderer.renderPass();
+        if (checkpoint) {
+            checkpoint->step(renderer);
+            if (!checkpoint->busy() && secondsSince(start) - lastCheckpoint >= checkpointInterval) {
+                checkpoint->begin(renderer);
+                lastCheckpoint = secondsSince(start);
+            }
+        }
+        glFinish();
+        seconds = secondsSince(start);
+        int passes = renderer.accumulatedPasses() - firstPass;
+        if (timeBudget > 0.0 && seconds + seconds / passes > timeBudget) break;
+    }
+    return seconds;
+}
+
+static void countPasses(RenderStats& stats, int passes, int pixelCount) {
+    stats.pixelPasses += (double)passes * pixelCount;
+    stats.minPasses = (stats.minPasses < 0) ? passes : std::min(stats.minPasses, passes);
+    stats.maxPasses = std::max(stats.maxPasses, passes);
+}
+
+// Reads the denoiser's width x height window at (left, top) of the renderer's targets, counted from the
+// top left, with its feature buffers into the denoiser and filters it
+static void denoiseWindow(Renderer& renderer, Denoiser& denoiser, int left, int top) {
+    int targetWidth = renderer.width();
+    std::vector<float> color((size_t)BAND_ROWS * targetWidth * 4);
+    std::vector<float> albedo(color.size());
+    std::vector<float> normalDepth(color.size());
+    for (int bandTop = 0; bandTop < denoiser.height(); bandTop += BAND_ROWS) {
+        int rowCount = std::min(BAND_ROWS, denoiser.height() - bandTop);
+        int rowBegin = renderer.height() - top - bandTop - rowCount;
+        renderer.readRows(rowBegin, rowCount, color.data());
+        renderer.readFeatureRows(FEATURE_ALBEDO, rowBegin, rowCount, albedo.data());
+        renderer.readFeatureRows(FEATURE_NORMAL_DEPTH, rowBegin, rowCount, normalDepth.data());
+        // GL rows start at the bottom, the denoiser's at the top
+        for (int row = 0; row < rowCount; ++row) {
+            size_t offset = ((size_t)(rowCount - 1 - row) * targetWidth + left) * 4;
+            denoiser.setRows(bandTop + row, 1, color.data() + offset, albedo.data() + offset, normalDepth.data() + offset);
+        }
+    }
+    denoiser.denoise(defaultDenoiseSettings());
+}
+
+// Reads the width x rowCount window at (left, top) of the renderer's targets, counted from the top left,
+// into pixels of `channels` floats, top row first (see IMAGE_CHANNELS). Alpha holds the pixel's own sample
+// count, from its pass count in the accumulation, where EXR outputs keep it as the weight for merging
+// renders. With a denoiser, its radiance replaces the renderer's;
+// it holds the window of the targets at (denoiserLeft, denoiserTop), which must cover this one.
+static void readPixels(Renderer& renderer, const Denoiser* denoiser, int denoiserLeft, int denoiserTop, int left, int top, int width,
+                       int rowCount, int channels, std::vector<float>& pixels) {
+    int targetWidth = renderer.width();
+    size_t targetPixels = (size_t)rowCount * targetWidth;
+    // GL rows start at the bottom
+    int glRow = renderer.height() - top - rowCount;
+    std::vector<float> color(targetPixels * 4);
+    renderer.readRows(glRow, rowCount, color.data());
+    std::vector<float> denoised;
+    if (denoiser) {
+        denoised.resize((size_t)rowCount * denoiser->width() * 4);
+        denoiser->getRows(top - denoiserTop, rowCount, denoised.data());
+    }
+    std::vector<float> albedo, normalDepth;
+    if (channels == IMAGE_CHANNELS_WITH_AOVS) {
+        albedo.resize(targetPixels * 4);
+        normalDepth.resize(targetPixels * 4);
+        renderer.readFeatureRows(FEATURE_ALBEDO, glRow, rowCount, albedo.data());
+        renderer.readFeatureRows(FEATURE_NORMAL_DEPTH, glRow, rowCount, normalDepth.data());
+    }
+
+    pixels.resize((size_t)rowCount * width * channels);
+    float samplesPerPass = (float)renderer.samplesPerPass();
+    for (int row = 0; row < rowCount; ++row) {
+        size_t glPixel = (size_t)(rowCount - 1 - row) * targetWidth + left;
+        size_t denoisedPixel = denoiser ? (size_t)row * denoiser->width() + left - denoiserLeft : 0;
+        for (int x = 0; x < width; ++x) {
+            float* pixel = &pixels[((size_t)row * width + x) * channels];
+            const float* radiance = denoiser ? &denoised[(denoisedPixel + x) * 4] : &color[(glPixel + x) * 4];
+            std::copy(radiance, radiance + 3, pixel);
+            pixel[3] = color[(glPixel + x) * 4 + 3] * samplesPerPass;
+            if (channels == IMAGE_CHANNELS_WITH_AOVS) {
+                std::copy(&albedo[(glPixel + x) * 4], &albedo[(glPixel + x) * 4] + 4, pixel + 4);
+                std::copy(&normalDepth[(glPixel + x) * 4], &normalDepth[(glPixel + x) * 4] + 4, pixel + 8);
+            }
+        }
+    }
+}
+
+// Renders the whole frame, then streams it to the writer top row first, one band of rows at a time.
+// With a denoiser, the frame is filtered first and the denoised radiance is written instead.
+static bool renderWhole(Renderer& renderer, ImageWriter& writer, int channels, int targetPasses, double timeBudget,
+                        Checkpoint* checkpoint, double checkpointInterval, Denoiser* denoiser, RenderStats& stats) {
+    stats.resumedPixelPasses = (double)renderer.accumulatedPasses() * renderer.width() * renderer.height();
+    stats.renderSeconds = accumulatePasses(renderer, targetPasses, timeBudget, checkpoint, checkpointInterval);
+    if (checkpoint) checkpoint->save(renderer);
+    if (s_stopRequested) return true;
+
+    if (denoiser) {
+        std::chrono::steady_clock::time_point denoiseStart = std::chrono::steady_clock::now();
+        denoiseWindow(renderer, *denoiser, 0, 0);
+        stats.denoiseSeconds = secondsSince(denoiseStart);
+    }
+
+    std::chrono::steady_clock::time_point writeStart = std::chrono::steady_clock::now();
+    int width = renderer.width();
+    int height = renderer.height();
+    std::vector<float> band;
+    for (int top = 0; top < height; top += BAND_ROWS) {
+        int rowCount = std::min(BAND_ROWS, height - top);
+        readPixels(renderer, denoiser, 0, 0, 0, top, width, rowCount, channels, band);
+        if (!writer.writeRows(band.data(), rowCount)) return false;
+    }
+    countPasses(stats, renderer.accumulatedPasses(), width * height);
+    bool written = writer.finish();
+    stats.writeSeconds = secondsSince(writeStart);
+    return written;
+}
+
+// Renders bucket `index` (row-major from the top left) to completion and copies it into tile, top row
+// first, with `channels` floats per pixel. Returns the seconds spent on passes. The bucket fills the top
+// left of the target, inside an apron of `apron` pixels; edge buckets cut short by the image border just
+// leave the rest of the target unused. With a denoise pool the bucket is denoised, together with the
+// parts of the apron inside the image, so every pixel is filtered as in a whole-frame render; the time
+// that takes is added to denoiseSeconds.
+static double renderBucket(Renderer& renderer, int imageWidth, int imageHeight, int bucketSize, int apron, int index, int channels,
+                           int targetPasses, double timeBudget, ThreadPool* denoisePool, double& denoiseSeconds,
+                           std::vector<float>& tile, int& width, int& height) {
+    int bucketsX = (imageWidth + bucketSize - 1) / bucketSize;
+    int left = (index % bucketsX) * bucketSize;
+    int top = (index / bucketsX) * bucketSize;
+    width = std::min(bucketSize, imageWidth - left);
+    height = std::min(bucketSize, imageHeight - top);
+
+    renderer.setImageRegion(imageWidth, imageHeight, left - apron, imageHeight - top - bucketSize - apron);
+    double seconds = accumulatePasses(renderer, targetPasses, timeBudget);
+
+    if (!denoisePool) {
+        readPixels(renderer, NULL, 0, 0, apron, apron, width, height, channels, tile);
+        return seconds;
+    }
+    // Pixels outside the image are left out, the denoiser mirrors its taps at the image edges instead
+    std::chrono::steady_clock::time_point denoiseStart = std::chrono::steady_clock::now();
+    int windowLeft = apron - std::min(apron, left);
+    int windowTop = apron - std::min(apron, top);
+    int windowRight = apron + width + std::min(apron, imageWidth - left - width);
+    int windowBottom = apron + height + std::min(apron, imageHeight - top - height);
+    Denoiser denoiser(windowRight - windowLeft, windowBottom - windowTop, *denoisePool);
+    denoiseWindow(renderer, denoiser, windowLeft, windowTop);
+    readPixels(renderer, &denoiser, windowLeft, windowTop, apron, apron, width, height, channels, tile);
+    denoiseSeconds += secondsSince(denoiseStart);
+    return seconds;
+}
+
+// Renders the image one bucket at a time to completion and writes each bucket as soon as it is done.
+// The renderer's targets are bucket sized (plus the apron), so GPU and host memory don't depend on
+// the image size. A time budget is shared out evenly over the buckets still to render.
+static bool renderBuckets(Renderer& renderer, ImageWriter& writer, int channels, int imageWidth, int imageHeight, int bucketSize,
+                          int apron, int targetPasses, double timeBudget, ThreadPool* denoisePool, RenderStats& stats) {
+    int bucketsX = (imageWidth + bucketSize - 1) / bucketSize;
+    int bucketsY = (imageHeight + bucketSize - 1) / bucketSize;
+    int bucketCount = bucketsX * bucketsY;
+    std::vector<float> tile;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (int bucket = 0; bucket < bucketCount; ++bucket) {
+        double bucketBudget = (timeBudget > 0.0) ? std::max(0.0, timeBudget - secondsSince(start)) / (bucketCount - bucket) : 0.0;
+        int width, height;
+        stats.renderSeconds += renderBucket(renderer, imageWidth, imageHeight, bucketSize, apron, bucket, channels, targetPasses, bucketBudget,
+                                            denoisePool, stats.denoiseSeconds, tile, width, height);
+
+        std::chrono::steady_clock::time_point writeStart = std::chrono::steady_clock::now();
+        int left = (bucket % bucketsX) * bucketSize;
+        int top = (bucket / bucketsX) * bucketSize;
+        if (!writer.writeTile(left, top, width, height, tile.data())) return false;
+        stats.writeSeconds += secondsSince(writeStart);
+        countPasses(stats, renderer.accumulatedPasses(), width * height);
+    }
+
+    std::chrono::steady_clock::time_point finishStart = std::chrono::steady_clock::now();
+    bool written = writer.finish();
+    stats.writeSeconds += secondsSince(finishStart);
+    return written;
+}
+
+static bool createContext(HeadlessContext& context, int threadCount) {
+    // Mesa's software rasterizer reads its thread count when the context is created. Hardware
+    // drivers schedule the GPU themselves and ignore it.
+    if (threadCount > 0) setenv("LP_NUM_THREADS", std::to_string(threadCount).c_str(), 1);
+
+    if (!context.create(4, 3)) return false;
+    if (!gladLoadGLLoader((GLADloadproc)HeadlessContext::getProcAddress)) {
+        std::cerr << "Failed to initialize GLAD\n";
+        return false;
+    }
+    std::cout << "Context: " << context.description() << ", " << glGetString(GL_RENDERER) << "\n";
+    return true;
+}
+
+// Renders the buckets handed out by a coordinator (--serve) until it says the job is done
+static int runWorker(const std::string& address, const std::string& backendArg, int threadCount, const std::string& textureCache) {
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        std::cerr << "Expected HOST:PORT, got " << address << "\n";
+        return -1;
+    }
+
+    HeadlessContext context;
+    if (!createContext(context, threadCount)) return -1;
+
+    TextureLoader textureLoader(0, textureCache);
+    std::unique_ptr<Renderer> renderer;
+    std::unique_ptr<ThreadPool> denoisePool;
+    TileJob job;
+    TileJobFunction setup = [&](const TileJob& received) {
+        job = received;
+        Scene scene;
+        Camera camera;
+        std::istringstream sceneText(job.sceneText);
+        if (!parseScene(sceneText, "coordinator scene", scene, camera)) return false;
+        bool denoise = job.denoise != 0;
+        int targetSize = job.bucketSize + 2 * bucketApron(denoise);
+        if (backendArg == "auto") renderer = createFastestRenderer(targetSize, targetSize, scene, camera, textureLoader, denoise);
+        else renderer = createRenderer(targetSize, targetSize, backendArg == "compute" ? BACKEND_COMPUTE : BACKEND_FRAGMENT, scene, camera, textureLoader,
+                                       denoise);
+        if (renderer) renderer->setSampleSeed(job.seed);
+        if (denoise && !denoisePool) denoisePool.reset(new ThreadPool());
+        return renderer != NULL;
+    };
+    TileRenderFunction render = [&](int index, std::vector<float>& rgba, int& width, int& height) {
+        if (!renderer) return false;
+        double denoiseSeconds = 0.0;
+        renderBucket(*renderer, job.width, job.height, job.bucketSize, bucketApron(job.denoise != 0), index, IMAGE_CHANNELS,
+                     job.targetPasses, 0.0, job.denoise ? denoisePool.get() : NULL, denoiseSeconds, rgba, width, height);
+        return true;
+    };
+    return runTileWorker(address.substr(0, colon), std::atoi(address.c_str() + colon + 1), setup, render) ? 0 : -1;
+}
+
+int main(int argc, char** argv) {
+    std::string scenePath;
+    std::string outputPath;
+    std::string backendArg = "auto"; // "auto" benchmarks both backends and keeps the faster one
+    int width = 1920;
+    int height = 1080;
+    int samplesPerPixel = 0;  // 0 = no sample target
+    double timeBudget = 0.0;  // Wall-clock seconds for rendering, 0 = no time limit
+    int threadCount = 0;      // Software rasterizer threads, 0 = driver default
+    bool halfFloat = false;   // EXR channels as half instead of float
+    std::string compressionName = "zip";
+    int bucketSize = 0;       // Render in bucketSize x bucketSize regions, 0 = the whole frame at once
+    std::string checkpointPath;
+    double checkpointInterval = 300.0; // Seconds between checkpoints
+    bool resume = false;
+    int servePort = 0;           // Coordinate workers on this port instead of rendering
+    std::string workerAddress;   // HOST:PORT of the coordinator to render for
+    double tileTimeout = 0.0;    // Seconds before a tile is handed out again, 0 = from the average tile time
+    int seed = 0;                // Sample sequence, renders with different seeds can be merged
+    bool denoise = false;        // Filter the frame on the CPU, guided by first-hit albedo, normal and depth
+    bool aovs = false;           // Also write first-hit albedo, normal, depth and object index to EXR outputs
+    std::string textureCache = defaultTextureCacheDirectory(); // Decoded textures with mips, "none" decodes every time
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--scene" && i + 1 < argc) {
+            scenePath = argv[++i];
+        } else if (arg == "--output" && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (arg == "--width" && i + 1 < argc) {
+            width = std::atoi(argv[++i]);
+        } else if (arg == "--height" && i + 1 < argc) {
+            height = std::atoi(argv[++i]);
+        } else if (arg == "--spp" && i + 1 < argc) {
+            samplesPerPixel = std::atoi(argv[++i]);
+        } else if (arg == "--time" && i + 1 < argc) {
+            timeBudget = std::atof(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threadCount = std::atoi(argv[++i]);
+        } else if (arg == "--backend" && i + 1 < argc) {
+            backendArg = argv[++i];
+        } else if (arg == "--bucket" && i + 1 < argc) {
+            bucketSize = std::atoi(argv[++i]);
+        } else if (arg == "--half") {
+            halfFloat = true;
+        } else if (arg == "--compression" && i + 1 < argc) {
+            compressionName = argv[++i];
+        } else if (arg == "--checkpoint" && i + 1 < argc) {
+            checkpointPath = argv[++i];
+        } else if (arg == "--checkpoint-interval" && i + 1 < argc) {
+            checkpointInterval = std::atof(argv[++i]);
+        } else if (arg == "--resume") {
+            resume = true;
+        } else if (arg == "--serve" && i + 1 < argc) {
+            servePort = std::atoi(argv[++i]);
+        } else if (arg == "--worker" && i + 1 < argc) {
+            workerAddress = argv[++i];
+        } else if (arg == "--tile-timeout" && i + 1 < argc) {
+            tileTimeout = std::atof(argv[++i]);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = std::atoi(argv[++i]);
+        } else if (arg == "--denoise") {
+            denoise = true;
+        } else if (arg == "--aovs") {
+            aovs = true;
+        } else if (arg == "--texture-cache" && i + 1 < argc) {
+            textureCache = argv[++i];
+        } else {
+            scenePath.clear();
+            workerAddress.clear();
+            break;
+        }
+    }
+    if (textureCache == "none") textureCache.clear();
+    if (!workerAddress.empty() && (backendArg == "auto" || backendArg == "fragment" || backendArg == "compute")) {
+        return runWorker(workerAddress, backendArg, threadCount, textureCache);
+    }
+    if (scenePath.empty() || outputPath.empty() || width <= 0 || height <= 0 || bucketSize < 0 ||
+        (backendArg != "auto" && backendArg != "fragment" && backendArg != "compute") ||
+        (compressionName != "none" && compressionName != "zips" && compressionName != "zip") ||
+        (resume && checkpointPath.empty())) {
+        std::cerr << "Usage: " << argv[0] << " --scene FILE --output FILE [--width W] [--height H] [--spp N] [--time SECONDS] [--threads N] [--backend auto|fragment|compute] [--half] [--compression none|zips|zip] [--bucket SIZE] [--seed N] [--denoise] [--aovs] [--texture-cache DIR|none] [--checkpoint FILE [--checkpoint-interval SECONDS] [--resume]] [--serve PORT [--tile-timeout SECONDS]]\n"
+                  << "       " << argv[0] << " --worker HOST:PORT [--threads N] [--backend auto|fragment|compute] [--texture-cache DIR|none]\n";
+        return -1;
+    }
+    if (servePort > 0 && (bucketSize <= 0 || timeBudget > 0.0 || !checkpointPath.empty())) {
+        std::cerr << "Distributed rendering needs --bucket and --spp, without --time or --checkpoint\n";
+        return -1;
+    }
+    if (bucketSize > 0 && !checkpointPath.empty()) {
+        // Buckets are written out as they finish, there is no whole-frame state to save
+        std::cerr << "Checkpoints need whole-frame rendering, they can't be combined with --bucket\n";
+        return -1;
+    }
+    if (servePort > 0 && aovs) {
+        // Workers send back radiance and sample counts only
+        std::cerr << "AOVs can't be combined with --serve\n";
+        return -1;
+    }
+    ExrCompression compression = EXR_ZIP_COMPRESSION;
+    if (compressionName == "none") compression = EXR_NO_COMPRESSION;
+    else if (compressionName == "zips") compression = EXR_ZIPS_COMPRESSION;
+    if (samplesPerPixel <= 0 && timeBudget <= 0.0) samplesPerPixel = 64;
+
+    Scene scene;
+    Camera camera;
+    if (!loadScene(scenePath, scene, camera)) return -1;
+
+    // Open the output before rendering, a bad path shouldn't cost a whole render. Buckets go
+    // to EXR files as tiles, which can be written in any order. EXR files carry the sample counts,
+    // so renders of the same frame with different seeds can be merged, and the AOVs as extra layers.
+    std::unique_ptr<ImageWriter> writer = createImageWriter(outputPath, width, height, halfFloat, compression, bucketSize, true, aovs);
+    if (!writer) return -1;
+
+    // Every pass traces framePasses samples per pixel
+    int framePasses = scene.settings.framePasses;
+    int targetPasses = samplesPerPixel > 0 ? (samplesPerPixel + framePasses - 1) / framePasses : 0;
+
+    if (servePort > 0) {
+        // The coordinator only hands out buckets and writes them, it needs no GL context
+        TileJob job = {width, height, bucketSize, targetPasses, seed, denoise ? 1 : 0, readFile(scenePath)};
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (!runTileCoordinator(servePort, job, *writer, tileTimeout)) {
+            std::cerr << "Failed to write " << outputPath << "\n";
+            return -1;
+        }
+        double seconds = secondsSince(start);
+        std::cout << "Resolution: " << width << "x" << height << " in " << bucketSize << "x" << bucketSize << " buckets\n"
+                  << "Samples per pixel: " << targetPasses * framePasses << "\n"
+                  << "Total time: " << seconds << " s\n"
+                  << "Camera rays/s: " << (double)width * height * targetPasses * framePasses / seconds << "\n"
+                  << "Output: " << outputPath << "\n";
+        return 0;
+    }
+
+    // The skybox decodes while the context is created, the renderer takes the request over
+    TextureLoader textureLoader(0, textureCache);
+    std::shared_ptr<TextureRequest> skybox = Renderer::loadSkybox(textureLoader, scene.skyboxPath);
+    HeadlessContext context;
+    if (!createContext(context, threadCount)) return -1;
+
+    std::chrono::steady_clock::time_point jobStart = std::chrono::steady_clock::now();
+    int apron = bucketApron(denoise);
+    int targetWidth = bucketSize > 0 ? bucketSize + 2 * apron : width;
+    int targetHeight = bucketSize > 0 ? bucketSize + 2 * apron : height;
+    // The denoiser's guides and the AOVs both come from the feature buffers
+    bool featureBuffers = denoise || aovs;
+    std::unique_ptr<Renderer> renderer;
+    if (backendArg == "auto") renderer = createFastestRenderer(targetWidth, targetHeight, scene, camera, textureLoader, featureBuffers);
+    else renderer = createRenderer(targetWidth, targetHeight, backendArg == "compute" ? BACKEND_COMPUTE : BACKEND_FRAGMENT, scene, camera, textureLoader,
+                                   featureBuffers);
+    if (!renderer) {
+        std::cerr << "Failed to initialize the renderer\n";
+        return -1;
+    }
+    renderer->setSampleSeed(seed);
+
+    std::unique_ptr<Checkpoint> checkpoint;
+    if (!checkpointPath.empty()) {
+        AccumulationMode accumulation = renderer->accumulationMode();
+        checkpoint.reset(new Checkpoint(checkpointPath, width, height, accumulation, hashScene(scene, camera), seed));
+        if (!checkpoint->open(resume)) return -1;
+        if (resume && checkpoint->restore(*renderer)) {
+            std::cout << "Resumed from " << checkpointPath << " at " << renderer->accumulatedPasses() * framePasses << " spp\n";
+        }
+        std::signal(SIGTERM, requestStop);
+        std::signal(SIGINT, requestStop);
+    }
+
+    // Denoising runs on the CPU, on all hardware threads: --threads only concerns the rasterizer.
+    // Buckets get a denoiser of their own size each.
+    std::unique_ptr<ThreadPool> denoisePool;
+    std::unique_ptr<Denoiser> denoiser;
+    if (denoise) {
+        denoisePool.reset(new ThreadPool());
+        if (bucketSize == 0) denoiser.reset(new Denoiser(width, height, *denoisePool));
+    }
+
+    RenderStats stats = RenderStats();
+    stats.minPasses = -1;
+    int channels = aovs ? IMAGE_CHANNELS_WITH_AOVS : IMAGE_CHANNELS;
+    bool written = (bucketSize > 0) ? renderBuckets(*renderer, *writer, channels, width, height, bucketSize, apron, targetPasses, timeBudget,
+                                                    denoisePool.get(), stats)
+                                    : renderWhole(*renderer, *writer, channels, targetPasses, timeBudget, checkpoint.get(),
+                                                  checkpointInterval, denoiser.get(), stats);
+    if (s_stopRequested) {
+        std::cerr << "Stopped at " << renderer->accumulatedPasses() * framePasses << " spp, resume with --resume --checkpoint " << checkpointPath << "\n";
+        return 2;
+    }
+    if (!written) {
+        std::cerr << "Failed to write " << outputPath << "\n";
+        return -1;
+    }
+
+    double cameraRays = (stats.pixelPasses - stats.resumedPixelPasses) * framePasses;
+    std::cout << "Backend: " << backendName(renderer->backend()) << "\n"
+              << "Resolution: " << width << "x" << height;
+    if (bucketSize > 0) std::cout << " in " << bucketSize << "x" << bucketSize << " buckets";
+    std::cout << "\nSamples per pixel: " << stats.minPasses * framePasses;
+    if (stats.maxPasses != stats.minPasses) std::cout << " to " << stats.maxPasses * framePasses;
+    std::cout << "\nRender time: " << stats.renderSeconds << " s\n";
+    if (denoise) std::cout << "Denoise time: " << stats.denoiseSeconds << " s\n";
+    std::cout << "Write time: " << stats.writeSeconds << " s\n"
+              << "Total time: " << secondsSince(jobStart) << " s\n"
+              << "Camera rays/s: " << cameraRays / stats.renderSeconds << "\n"
+              << "Output: " << outputPath << "\n";
+    return 0;
+}
@@ -0,0 +1,31 @@
+#include "camera.h"
+#include <cmath>
+
+void Camera::getRotationMatrix(float out[16]) const {
+    float cy = std::cos(yaw), sy = std::sin(yaw);
+    float cp = std::cos(pitch), sp = std::sin(pitch);
+
+    // Camera-to-world rotation R = Ry(yaw) * Rx(pitch), written row by row
+    float r[9] = {
+         cy, sy * sp, sy * cp,
+        0.0f,     cp,     -sp,
+        -sy, cy * sp, cy * cp
+    };
+
+    for (int row = 0; row < 4; ++row) {
+        for (int col = 0; col < 4; ++col) {
+            float value = (row == col) ? 1.0f : 0.0f;
+            if (row < 3 && col < 3) value = r[row * 3 + col];
+            // Row-major R read as column-major is R transposed, which is what vec * matrix needs
+            out[row * 4 + col] = value;
+        }
+    }
+}
+
+Camera createDefaultCamera() {
+    Camera camera;
+    camera.position = Vec3{0.0f, 1.5f, 6.0f};
+    camera.yaw = 0.0f;
+    camera.pitch = -0.1f;
+    return camera;
+}
@@ -0,0 +1,149 @@
+#include "checkpoint.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+// Version 2: running averages count their passes in alpha, version 1 files held 1 there.
+// Version 3: the header holds the sample seed.
+static const char CHECKPOINT_MAGIC[8] = {'R', 'T', 'C', 'H', 'E', 'C', 'K', '3'};
+static const size_t HEADER_SIZE = 4096; // One page, so the slots stay page aligned
+static const int BAND_ROWS = 32;        // Rows read back per step()
+
+struct Checkpoint::Header {
+    char magic[8];
+    int width;
+    int height;
+    int accumulation;
+    int activeSlot; // Slot of the last complete checkpoint, -1 if there is none yet
+    unsigned long long sceneHash;
+    int passes[2];  // Pass count of each slot
+    int seed;       // Renderer::setSampleSeed()
+};
+
+Checkpoint::Checkpoint(const std::string& path, int width, int height, AccumulationMode accumulation, unsigned long long sceneHash,
+                       int seed)
+    : m_path(path), m_width(width), m_height(height), m_accumulation(accumulation), m_sceneHash(sceneHash), m_seed(seed),
+      m_fd(-1), m_mapped(NULL), m_size(HEADER_SIZE + 2 * (size_t)width * height * 4 * sizeof(float)),
+      m_writeSlot(0), m_snapshotPasses(0), m_nextRow(-1) {
+}
+
+Checkpoint::~Checkpoint() {
+    if (m_mapped) {
+        msync(m_mapped, m_size, MS_SYNC);
+        munmap(m_mapped, m_size);
+    }
+    if (m_fd >= 0) close(m_fd);
+}
+
+bool Checkpoint::open(bool resume) {
+    m_fd = ::open(m_path.c_str(), resume ? O_RDWR : (O_RDWR | O_CREAT), 0644);
+    if (m_fd < 0) {
+        std::cerr << "Failed to open checkpoint " << m_path << std::endl;
+        return false;
+    }
+    struct stat info;
+    bool sized = fstat(m_fd, &info) == 0 && (size_t)info.st_size == m_size;
+    if (resume && !sized) {
+        std::cerr << "Checkpoint " << m_path << " was written for a different resolution" << std::endl;
+        return false;
+    }
+    if (!sized && ftruncate(m_fd, (off_t)m_size) != 0) {
+        std::cerr << "Failed to size checkpoint " << m_path << std::endl;
+        return false;
+    }
+
+    void* mapped = mmap(NULL, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Failed to map checkpoint " << m_path << std::endl;
+        return false;
+    }
+    m_mapped = (unsigned char*)mapped;
+
+    Header* state = header();
+    bool matches = std::memcmp(state->magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) == 0 &&
+                   state->width == m_width && state->height == m_height &&
+                   state->accumulation == (int)m_accumulation && state->sceneHash == m_sceneHash;
+    if (resume) {
+        if (!matches) {
+            std::cerr << "Checkpoint " << m_path << " belongs to a different scene or settings" << std::endl;
+            return false;
+        }
+        // Resuming under another seed would pass the old seed's samples off as the new one's, and merging
+        // the result with a render of the old seed would count them twice
+        if (state->seed != m_seed) {
+            std::cerr << "Checkpoint " << m_path << " was rendered with --seed " << state->seed << std::endl;
+            return false;
+        }
+    } else {
+        // A fresh render: forget whatever the file held before
+        std::memset(state, 0, sizeof(Header));
+        std::memcpy(state->magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+        state->width = m_width;
+        state->height = m_height;
+        state->accumulation = (int)m_accumulation;
+        state->sceneHash = m_sceneHash;
+        state->seed = m_seed;
+        state->activeSlot = -1;
+        msync(m_mapped, HEADER_SIZE, MS_SYNC);
+    }
+    return true;
+}
+
+float* Checkpoint::slot(int index) const {
+    return (float*)(m_mapped + HEADER_SIZE) + (size_t)index * m_width * m_height * 4;
+}
+
+int Checkpoint::passes() const {
+    const Header* state = header();
+    return state->activeSlot >= 0 ? state->passes[state->activeSlot] : 0;
+}
+
+bool Checkpoint::restore(Renderer& renderer) {
+    int active = header()->activeSlot;
+    if (active < 0 || header()->passes[active] <= 0) return false;
+    renderer.loadAccumulation(slot(active), header()->passes[active]);
+    return true;
+}
+
+void Checkpoint::begin(Renderer& renderer) {
+    if (busy() || renderer.accumulatedPasses() == 0) return;
+    m_writeSlot = (header()->activeSlot == 0) ? 1 : 0;
+    m_snapshotPasses = renderer.snapshotAccumulation();
+    m_nextRow = 0;
+}
+
+void Checkpoint::step(Renderer& renderer) {
+    if (!busy()) return;
+
+    int rowCount = std::min(BAND_ROWS, m_height - m_nextRow);
+    float* band = slot(m_writeSlot) + (size_t)m_nextRow * m_width * 4;
+    renderer.readSnapshotRows(m_nextRow, rowCount, band);
+    // Start the write-back now, so little is left to wait for when the slot is finished
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    unsigned char* pageStart = (unsigned char*)((size_t)band & ~(pageSize - 1));
+    msync(pageStart, (unsigned char*)(band + (size_t)rowCount * m_width * 4) - pageStart, MS_ASYNC);
+
+    m_nextRow += rowCount;
+    if (m_nextRow == m_height) finishSlot();
+}
+
+void Checkpoint::finishSlot() {
+    // The slot has to be on disk before the header points at it
+    msync(slot(m_writeSlot), (size_t)m_width * m_height * 4 * sizeof(float), MS_SYNC);
+    header()->passes[m_writeSlot] = m_snapshotPasses;
+    header()->activeSlot = m_writeSlot;
+    msync(m_mapped, HEADER_SIZE, MS_SYNC);
+    m_nextRow = -1;
+}
+
+void Checkpoint::save(Renderer& renderer) {
+    // Restart any checkpoint in flight from the current state and finish it in one go
+    m_nextRow = -1;
+    if (renderer.accumulatedPasses() == 0 || renderer.accumulatedPasses() == passes()) return;
+    begin(renderer);
+    while (busy()) step(renderer);
+}
@@ -0,0 +1,138 @@
+#include "context.h"
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <iostream>
+#ifdef RAYTRACER_OSMESA
+#include <GL/osmesa.h>
+#endif
+
+static bool s_usingOSMesa = false;
+
+HeadlessContext::HeadlessContext()
+    : m_display(EGL_NO_DISPLAY), m_context(EGL_NO_CONTEXT), m_surface(EGL_NO_SURFACE),
+      m_osmesaContext(NULL), m_osmesaBuffer(NULL) {
+}
+
+HeadlessContext::~HeadlessContext() {
+    destroy();
+}
+
+void HeadlessContext::destroy() {
+    if (m_display != EGL_NO_DISPLAY) {
+        eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (m_surface != EGL_NO_SURFACE) eglDestroySurface(m_display, m_surface);
+        if (m_context != EGL_NO_CONTEXT) eglDestroyContext(m_display, m_context);
+        eglTerminate(m_display);
+    }
+    m_display = EGL_NO_DISPLAY;
+    m_context = EGL_NO_CONTEXT;
+    m_surface = EGL_NO_SURFACE;
+
+#ifdef RAYTRACER_OSMESA
+    if (m_osmesaContext) OSMesaDestroyContext((OSMesaContext)m_osmesaContext);
+#endif
+    m_osmesaContext = NULL;
+    delete[] m_osmesaBuffer;
+    m_osmesaBuffer = NULL;
+}
+
+bool HeadlessContext::create(int major, int minor) {
+    if (createEGL(major, minor, true)) {
+        m_description = "EGL (surfaceless)";
+        return true;
+    }
+    destroy();
+    if (createEGL(major, minor, false)) {
+        m_description = "EGL (pbuffer)";
+        return true;
+    }
+    destroy();
+    if (createOSMesa(major, minor)) {
+        m_description = "OSMesa";
+        return true;
+    }
+    destroy();
+    std::cerr << "Failed to create a headless OpenGL " << major << "." << minor << " context" << std::endl;
+    return false;
+}
+
+bool HeadlessContext::createEGL(int major, int minor, bool surfaceless) {
+    EGLDisplay display = EGL_NO_DISPLAY;
+    if (surfaceless) {
+        // Needs no GPU and no display server at all
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (!getPlatformDisplay) return false;
+        display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    } else {
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+    if (display == EGL_NO_DISPLAY) return false;
+    m_display = display;
+
+    EGLint versionMajor, versionMinor;
+    if (!eglInitialize(display, &versionMajor, &versionMinor)) return false;
+    if (!eglBindAPI(EGL_OPENGL_API)) return false;
+
+    EGLConfig config = NULL;
+    if (!surfaceless) {
+        EGLint configAttributes[] = {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+            EGL_NONE
+        };
+        EGLint configCount = 0;
+        if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0) return false;
+
+        // Only needed to make the context current, rendering goes to FBOs
+        EGLint surfaceAttributes[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+        m_surface = eglCreatePbufferSurface(display, config, surfaceAttributes);
+        if (m_surface == EGL_NO_SURFACE) return false;
+    }
+
+    EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, major,
+        EGL_CONTEXT_MINOR_VERSION, minor,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    m_context = eglCreateContext(display, surfaceless ? EGL_NO_CONFIG_KHR : config, EGL_NO_CONTEXT, contextAttributes);
+    if (m_context == EGL_NO_CONTEXT) return false;
+
+    if (!eglMakeCurrent(display, (EGLSurface)m_surface, (EGLSurface)m_surface, (EGLContext)m_context)) return false;
+    s_usingOSMesa = false;
+    return true;
+}
+
+bool HeadlessContext::createOSMesa(int major, int minor) {
+#ifdef RAYTRACER_OSMESA
+    const int attributes[] = {
+        OSMESA_FORMAT, OSMESA_RGBA,
+        OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+        OSMESA_CONTEXT_MAJOR_VERSION, major,
+        OSMESA_CONTEXT_MINOR_VERSION, minor,
+        0
+    };
+    OSMesaContext context = OSMesaCreateContextAttribs(attributes, NULL);
+    if (!context) return false;
+    m_osmesaContext = context;
+
+    // OSMesa always needs a color buffer to be current, even though we only render to FBOs
+    m_osmesaBuffer = new unsigned char[4];
+    if (!OSMesaMakeCurrent(context, m_osmesaBuffer, GL_UNSIGNED_BYTE, 1, 1)) return false;
+    s_usingOSMesa = true;
+    return true;
+#else
+    (void)major;
+    (void)minor;
+    return false;
+#endif
+}
+
+void* HeadlessContext::getProcAddress(const char* name) {
+#ifdef RAYTRACER_OSMESA
+    if (s_usingOSMesa) return (void*)OSMesaGetProcAddress(name);
+#endif
+    return (void*)eglGetProcAddress(name);
+}
@@ -0,0 +1,218 @@
+#include "denoiser.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Rows per thread pool chunk
+static const int ROWS_PER_CHUNK = 8;
+// Channels with less albedo than this aren't demodulated, dividing would only amplify their noise
+static const float MIN_ALBEDO = 0.01f;
+// Floor of the depth the depth weight is relative to
+static const float MIN_DEPTH = 0.001f;
+// B3 spline weights by tap distance, 1/16 1/4 3/8 1/4 1/16 in each direction
+static const float KERNEL[3] = {3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+
+// Taps past an edge are mirrored back into the image, so gradients towards the edge don't bias the
+// average the way a one-sided kernel would
+static int mirror(int coordinate, int size) {
+    if (coordinate < 0) coordinate = -coordinate;
+    if (coordinate >= size) coordinate = 2 * (size - 1) - coordinate;
+    return std::min(std::max(coordinate, 0), size - 1);
+}
+
+DenoiseSettings defaultDenoiseSettings() {
+    DenoiseSettings settings;
+    settings.iterations = 4;
+    settings.colorSigma = 0.1f;
+    settings.normalSigma = 0.1f;
+    settings.depthSigma = 0.05f;
+    settings.albedoSigma = 0.1f;
+    return settings;
+}
+
+int denoiseReach(const DenoiseSettings& settings) {
+    // 2 * (1 + 2 + ... + 2^(iterations - 1))
+    return 2 * ((1 << settings.iterations) - 1);
+}
+
+static float demodulationFactor(float albedo) {
+    return albedo < MIN_ALBEDO ? 1.0f : albedo;
+}
+
+// e^-x for x >= 0, to about 1e-4 relative: 2^(-x log2 e) split into an integer power, built in the
+// exponent bits, and a fractional one from its Taylor series. negativeExp4() takes the same steps.
+static float negativeExp(float x) {
+    float t = std::max(-x * 1.44269504f, -126.0f);
+    float n = std::floor(t);
+    float f = t - n;
+    float p = 1.0f + f * (0.69314718f + f * (0.24022651f + f * (0.05550411f + f * (0.00961813f + f * 0.00133336f))));
+    uint32_t bits = (uint32_t)((int)n + 127) << 23;
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+#if defined(__SSE2__)
+static __m128 negativeExp4(__m128 x) {
+    __m128 t = _mm_max_ps(_mm_mul_ps(x, _mm_set1_ps(-1.44269504f)), _mm_set1_ps(-126.0f));
+    __m128 n = _mm_cvtepi32_ps(_mm_cvttps_epi32(t));
+    // Truncation rounds negative values up, step back down to the floor
+    n = _mm_sub_ps(n, _mm_and_ps(_mm_cmpgt_ps(n, t), _mm_set1_ps(1.0f)));
+    __m128 f = _mm_sub_ps(t, n);
+    __m128 p = _mm_set1_ps(0.00133336f);
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.00961813f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.05550411f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.24022651f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.69314718f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.0f));
+    __m128i bits = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(n), _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(p, _mm_castsi128_ps(bits));
+}
+
+static __m128 squared(__m128 value) {
+    return _mm_mul_ps(value, value);
+}
+#endif
+
+Denoiser::Denoiser(int width, int height, ThreadPool& pool)
+    : m_width(width), m_height(height), m_pool(pool) {
+    size_t pixelCount = (size_t)width * height;
+    for (int c = 0; c < 3; ++c) {
+        m_color[c].resize(pixelCount);
+        m_filtered[c].resize(pixelCount);
+        m_guide[c].resize(pixelCount);
+        m_normal[c].resize(pixelCount);
+        m_albedo[c].resize(pixelCount);
+    }
+    m_depth.resize(pixelCount);
+}
+
+void Denoiser::setRows(int rowBegin, int rowCount, const float* color, const float* albedo, const float* normalDepth) {
+    size_t first = (size_t)rowBegin * m_width;
+    size_t count = (size_t)rowCount * m_width;
+    for (size_t i = 0; i < count; ++i) {
+        for (int c = 0; c < 3; ++c) {
+            m_albedo[c][first + i] = albedo[i * 4 + c];
+            m_color[c][first + i] = color[i * 4 + c] / demodulationFactor(albedo[i * 4 + c]);
+            m_normal[c][first + i] = normalDepth[i * 4 + c];
+        }
+        m_depth[first + i] = normalDepth[i * 4 + 3];
+    }
+}
+
+void Denoiser::getRows(int rowBegin, int rowCount, float* rgba) const {
+    size_t first = (size_t)rowBegin * m_width;
+    size_t count = (size_t)rowCount * m_width;
+    for (size_t i = 0; i < count; ++i) {
+        for (int c = 0; c < 3; ++c) rgba[i * 4 + c] = m_color[c][first + i] * demodulationFactor(m_albedo[c][first + i]);
+    }
+}
+
+void Denoiser::denoise(const DenoiseSettings& settings) {
+    size_t pixelCount = (size_t)m_width * m_height;
+    for (int level = 0; level < settings.iterations; ++level) {
+        // Edges are found on the radiance of the previous level, compressed so bright pixels don't
+        // stop the filter everywhere
+        m_pool.parallelFor(m_height, ROWS_PER_CHUNK, [&](int rowBegin, int rowEnd) {
+            for (size_t i = (size_t)rowBegin * m_width; i < (size_t)rowEnd * m_width && i < pixelCount; ++i) {
+                for (int c = 0; c < 3; ++c) m_guide[c][i] = m_color[c][i] / (1.0f + m_color[c][i]);
+            }
+        });
+
+        float colorSigma = settings.colorSigma / (float)(1 << level);
+        float colorScale = 1.0f / (colorSigma * colorSigma);
+        m_pool.parallelFor(m_height, ROWS_PER_CHUNK, [&](int rowBegin, int rowEnd) {
+            filterRows(rowBegin, rowEnd, 1 << level, settings, colorScale);
+        });
+        for (int c = 0; c < 3; ++c) m_color[c].swap(m_filtered[c]);
+    }
+}
+
+void Denoiser::filterRows(int rowBegin, int rowEnd, int step, const DenoiseSettings& settings, float colorScale) {
+    float normalScale = 1.0f / (settings.normalSigma * settings.normalSigma);
+    float albedoScale = 1.0f / (settings.albedoSigma * settings.albedoSigma);
+    float depthScale = 1.0f / (settings.depthSigma * step);
+    int reach = 2 * step;
+
+    for (int y = rowBegin; y < rowEnd; ++y) {
+        auto filterPixel = [&](int x) {
+            size_t center = (size_t)y * m_width + x;
+            float pixelDepthScale = depthScale / std::max(m_depth[center], MIN_DEPTH);
+            float sum[3] = {0.0f, 0.0f, 0.0f};
+            float weightSum = 0.0f;
+            for (int j = -2; j <= 2; ++j) {
+                int tapY = mirror(y + j * step, m_height);
+                for (int i = -2; i <= 2; ++i) {
+                    int tapX = mirror(x + i * step, m_width);
+                    size_t tap = (size_t)tapY * m_width + tapX;
+                    float colorDistance = 0.0f, normalDistance = 0.0f, albedoDistance = 0.0f;
+                    for (int c = 0; c < 3; ++c) {
+                        float d = m_guide[c][tap] - m_guide[c][center];
+                        colorDistance += d * d;
+                        d = m_normal[c][tap] - m_normal[c][center];
+                        normalDistance += d * d;
+                        d = m_albedo[c][tap] - m_albedo[c][center];
+                        albedoDistance += d * d;
+                    }
+                    float depthDistance = std::fabs(m_depth[tap] - m_depth[center]);
+                    float weight = KERNEL[std::abs(i)] * KERNEL[std::abs(j)] *
+                                   negativeExp(colorDistance * colorScale + normalDistance * normalScale +
+                                               albedoDistance * albedoScale + depthDistance * pixelDepthScale);
+                    for (int c = 0; c < 3; ++c) sum[c] += weight * m_color[c][tap];
+                    weightSum += weight;
+                }
+            }
+            // The center tap always counts with 9/64
+            for (int c = 0; c < 3; ++c) m_filtered[c][center] = sum[c] / weightSum;
+        };
+
+        int x = 0;
+#if defined(__SSE2__)
+        // Pixels whose taps all lie inside the row, 4 at a time
+        for (; x < reach && x < m_width; ++x) filterPixel(x);
+        for (; x + 4 <= m_width - reach; x += 4) {
+            size_t center = (size_t)y * m_width + x;
+            __m128 guide[3], normal[3], albedo[3];
+            for (int c = 0; c < 3; ++c) {
+                guide[c] = _mm_loadu_ps(&m_guide[c][center]);
+                normal[c] = _mm_loadu_ps(&m_normal[c][center]);
+                albedo[c] = _mm_loadu_ps(&m_albedo[c][center]);
+            }
+            __m128 depth = _mm_loadu_ps(&m_depth[center]);
+            __m128 pixelDepthScale = _mm_div_ps(_mm_set1_ps(depthScale), _mm_max_ps(depth, _mm_set1_ps(MIN_DEPTH)));
+            __m128 sum[3] = {_mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps()};
+            __m128 weightSum = _mm_setzero_ps();
+            for (int j = -2; j <= 2; ++j) {
+                int tapY = mirror(y + j * step, m_height);
+                for (int i = -2; i <= 2; ++i) {
+                    size_t tap = (size_t)tapY * m_width + x + i * step;
+                    __m128 colorDistance = _mm_setzero_ps();
+                    __m128 normalDistance = _mm_setzero_ps();
+                    __m128 albedoDistance = _mm_setzero_ps();
+                    for (int c = 0; c < 3; ++c) {
+                        colorDistance = _mm_add_ps(colorDistance, squared(_mm_sub_ps(_mm_loadu_ps(&m_guide[c][tap]), guide[c])));
+                        normalDistance = _mm_add_ps(normalDistance, squared(_mm_sub_ps(_mm_loadu_ps(&m_normal[c][tap]), normal[c])));
+                        albedoDistance = _mm_add_ps(albedoDistance, squared(_mm_sub_ps(_mm_loadu_ps(&m_albedo[c][tap]), albedo[c])));
+                    }
+                    // |a - b| by clearing the sign bit
+                    __m128 depthDistance = _mm_andnot_ps(_mm_set1_ps(-0.0f), _mm_sub_ps(_mm_loadu_ps(&m_depth[tap]), depth));
+                    __m128 exponent = _mm_add_ps(_mm_add_ps(_mm_mul_ps(colorDistance, _mm_set1_ps(colorScale)),
+                                                            _mm_mul_ps(normalDistance, _mm_set1_ps(normalScale))),
+                                                 _mm_add_ps(_mm_mul_ps(albedoDistance, _mm_set1_ps(albedoScale)),
+                                                            _mm_mul_ps(depthDistance, pixelDepthScale)));
+                    __m128 weight = _mm_mul_ps(_mm_set1_ps(KERNEL[std::abs(i)] * KERNEL[std::abs(j)]), negativeExp4(exponent));
+                    for (int c = 0; c < 3; ++c) sum[c] = _mm_add_ps(sum[c], _mm_mul_ps(weight, _mm_loadu_ps(&m_color[c][tap])));
+                    weightSum = _mm_add_ps(weightSum, weight);
+                }
+            }
+            for (int c = 0; c < 3; ++c) _mm_storeu_ps(&m_filtered[c][center], _mm_div_ps(sum[c], weightSum));
+        }
+#endif
+        for (; x < m_width; ++x) filterPixel(x);
+    }
+}
@@ -0,0 +1,361 @@
+#include "distributed.h"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+// Every message is a MessageHeader followed by `size` payload bytes. Integers and floats are sent in
+// host byte order, so coordinator and workers have to share an architecture.
+enum MessageType {
+    MESSAGE_JOB = 1,    // Coordinator -> worker: width, height, bucket size, target passes, sample seed, denoise, scene text
+    MESSAGE_TILE = 2,   // Coordinator -> worker: bucket index
+    MESSAGE_RESULT = 3, // Worker -> coordinator: bucket index, width, height, RGBA floats
+    MESSAGE_DONE = 4    // Coordinator -> worker: no tiles left, disconnect
+};
+
+struct MessageHeader {
+    int type;
+    int size;
+};
+
+static const int MAX_MESSAGE_SIZE = 256 << 20;
+static const int POLL_INTERVAL_MS = 100; // How often overdue tiles are looked for while nothing happens
+
+static double nowSeconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool sendAll(int fd, const void* data, size_t size) {
+    const char* bytes = (const char*)data;
+    while (size > 0) {
+        // MSG_NOSIGNAL: a worker that went away must not kill the coordinator with SIGPIPE
+        ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (sent <= 0) return false;
+        bytes += sent;
+        size -= (size_t)sent;
+    }
+    return true;
+}
+
+static bool receiveAll(int fd, void* data, size_t size) {
+    char* bytes = (char*)data;
+    while (size > 0) {
+        ssize_t received = recv(fd, bytes, size, 0);
+        if (received <= 0) return false;
+        bytes += received;
+        size -= (size_t)received;
+    }
+    return true;
+}
+
+static bool sendMessage(int fd, int type, const std::vector<unsigned char>& payload) {
+    MessageHeader header = {type, (int)payload.size()};
+    return sendAll(fd, &header, sizeof(header)) && (payload.empty() || sendAll(fd, payload.data(), payload.size()));
+}
+
+static void appendInt(std::vector<unsigned char>& out, int value) {
+    const unsigned char* bytes = (const unsigned char*)&value;
+    out.insert(out.end(), bytes, bytes + sizeof(value));
+}
+
+static int readInt(const unsigned char* data) {
+    int value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+// Coordinator side
+
+namespace {
+
+enum TileStatus {
+    TILE_PENDING,
+    TILE_OUT,
+    TILE_DONE
+};
+
+struct Tile {
+    TileStatus status;
+    int copiesOut;      // Workers currently rendering it, more than one once it was overdue
+    double handedOutAt; // Of the oldest copy still out
+};
+
+struct WorkerConnection {
+    int fd;
+    std::string address;
+    int tile;                          // Tile being rendered, -1 if idle
+    double startedAt;
+    std::vector<unsigned char> buffer; // Received bytes not yet parsed into messages
+    int tilesRendered;
+};
+
+}
+
+static void releaseTile(std::vector<Tile>& tiles, int index) {
+    if (index < 0 || tiles[index].status == TILE_DONE) return;
+    tiles[index].copiesOut--;
+    if (tiles[index].copiesOut == 0) tiles[index].status = TILE_PENDING;
+}
+
+// Next pending tile, or else the longest overdue one that has a single copy out
+static int pickTile(const std::vector<Tile>& tiles, double now, double overdueAfter) {
+    int overdue = -1;
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        if (tiles[i].status == TILE_PENDING) return (int)i;
+        if (tiles[i].status == TILE_OUT && tiles[i].copiesOut == 1 && overdueAfter > 0.0 &&
+            now - tiles[i].handedOutAt > overdueAfter &&
+            (overdue < 0 || tiles[i].handedOutAt < tiles[overdue].handedOutAt)) {
+            overdue = (int)i;
+        }
+    }
+    return overdue;
+}
+
+static int listenOn(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    sockaddr_in address = sockaddr_in();
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((unsigned short)port);
+    if (bind(fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(fd, 16) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool runTileCoordinator(int port, const TileJob& job, ImageWriter& writer, double tileTimeout) {
+    int listener = listenOn(port);
+    if (listener < 0) {
+        std::cerr << "Failed to listen on port " << port << std::endl;
+        return false;
+    }
+    std::cout << "Waiting for workers on port " << port << std::endl;
+
+    int bucketsX = (job.width + job.bucketSize - 1) / job.bucketSize;
+    int bucketsY = (job.height + job.bucketSize - 1) / job.bucketSize;
+    Tile pending = {TILE_PENDING, 0, 0.0};
+    std::vector<Tile> tiles(bucketsX * bucketsY, pending);
+    int tilesLeft = (int)tiles.size();
+    int tilesResent = 0;
+    double tileSecondsTotal = 0.0;
+    int tilesTimed = 0;
+
+    std::vector<unsigned char> jobPayload;
+    appendInt(jobPayload, job.width);
+    appendInt(jobPayload, job.height);
+    appendInt(jobPayload, job.bucketSize);
+    appendInt(jobPayload, job.targetPasses);
+    appendInt(jobPayload, job.seed);
+    appendInt(jobPayload, job.denoise);
+    jobPayload.insert(jobPayload.end(), job.sceneText.begin(), job.sceneText.end());
+
+    std::vector<WorkerConnection> workers;
+    bool ok = true;
+    while (tilesLeft > 0 && ok) {
+        std::vector<pollfd> fds(1 + workers.size());
+        fds[0].fd = listener;
+        fds[0].events = POLLIN;
+        for (size_t i = 0; i < workers.size(); ++i) {
+            fds[i + 1].fd = workers[i].fd;
+            fds[i + 1].events = POLLIN;
+        }
+        poll(fds.data(), fds.size(), POLL_INTERVAL_MS);
+
+        // Read whatever arrived, drop the workers that went away
+        for (size_t i = 0; i < workers.size(); ++i) {
+            WorkerConnection& worker = workers[i];
+            bool alive = true;
+            if (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) {
+                unsigned char chunk[65536];
+                ssize_t received = recv(worker.fd, chunk, sizeof(chunk), 0);
+                if (received <= 0) alive = false;
+                else worker.buffer.insert(worker.buffer.end(), chunk, chunk + received);
+            }
+
+            while (alive && worker.buffer.size() >= sizeof(MessageHeader)) {
+                MessageHeader header;
+                std::memcpy(&header, worker.buffer.data(), sizeof(header));
+                if (header.type != MESSAGE_RESULT || header.size < 12 || header.size > MAX_MESSAGE_SIZE) {
+                    alive = false;
+                    break;
+                }
+                if (worker.buffer.size() < sizeof(header) + header.size) break;
+
+                const unsigned char* payload = worker.buffer.data() + sizeof(header);
+                int index = readInt(payload);
+                int width = readInt(payload + 4);
+                int height = readInt(payload + 8);
+                // Only the tile the worker was given, at that bucket's size: smaller only at the right and bottom edges
+                if (worker.tile < 0 || index != worker.tile) {
+                    alive = false;
+                    break;
+                }
+                int left = (index % bucketsX) * job.bucketSize;
+                int top = (index / bucketsX) * job.bucketSize;
+                if (width != std::min(job.bucketSize, job.width - left) || height != std::min(job.bucketSize, job.height - top) ||
+                    (size_t)header.size != 12 + (size_t)width * height * 4 * sizeof(float)) {
+                    alive = false;
+                    break;
+                }
+
+                Tile& tile = tiles[index];
+                if (tile.status != TILE_DONE) {
+                    // First copy back wins, late duplicates are dropped
+                    if (!writer.writeTile(left, top, width, height, (const float*)(payload + 12))) ok = false;
+                    tile.status = TILE_DONE;
+                    tilesLeft--;
+                    tileSecondsTotal += nowSeconds() - worker.startedAt;
+                    tilesTimed++;
+                }
+                releaseTile(tiles, index);
+                worker.tile = -1;
+                worker.tilesRendered++;
+                worker.buffer.erase(worker.buffer.begin(), worker.buffer.begin() + sizeof(header) + header.size);
+            }
+
+            if (!alive) {
+                std::cout << "Worker " << worker.address << " disconnected" << std::endl;
+                releaseTile(tiles, worker.tile);
+                close(worker.fd);
+                workers.erase(workers.begin() + i);
+                fds.erase(fds.begin() + i + 1);
+                --i;
+            }
+        }
+
+        // New workers join after the reads, fds has no entries for them
+        if (fds[0].revents & POLLIN) {
+            sockaddr_in address;
+            socklen_t length = sizeof(address);
+            int fd = accept(listener, (sockaddr*)&address, &length);
+            if (fd >= 0) {
+                int yes = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+                WorkerConnection worker = {fd, inet_ntoa(address.sin_addr), -1, 0.0, std::vector<unsigned char>(), 0};
+                if (sendMessage(fd, MESSAGE_JOB, jobPayload)) {
+                    std::cout << "Worker " << worker.address << " connected" << std::endl;
+                    workers.push_back(worker);
+                } else {
+                    close(fd);
+                }
+            }
+        }
+
+        // Keep every idle worker busy
+        double now = nowSeconds();
+        double overdueAfter = tileTimeout;
+        if (overdueAfter <= 0.0) overdueAfter = tilesTimed > 0 ? 3.0 * tileSecondsTotal / tilesTimed : 0.0;
+        for (size_t i = 0; i < workers.size(); ++i) {
+            WorkerConnection& worker = workers[i];
+            if (worker.tile >= 0) continue;
+            int index = pickTile(tiles, now, overdueAfter);
+            if (index < 0) break;
+
+            std::vector<unsigned char> payload;
+            appendInt(payload, index);
+            if (!sendMessage(worker.fd, MESSAGE_TILE, payload)) continue; // Noticed as a disconnect next round
+            if (tiles[index].status == TILE_OUT) tilesResent++;
+            else tiles[index].handedOutAt = now;
+            tiles[index].status = TILE_OUT;
+            tiles[index].copiesOut++;
+            worker.tile = index;
+            worker.startedAt = now;
+        }
+    }
+
+    for (size_t i = 0; i < workers.size(); ++i) {
+        sendMessage(workers[i].fd, MESSAGE_DONE, std::vector<unsigned char>());
+        std::cout << "Worker " << workers[i].address << ": " << workers[i].tilesRendered << " tiles" << std::endl;
+        close(workers[i].fd);
+    }
+    close(listener);
+    std::cout << "Tiles handed out again because they were overdue: " << tilesResent << std::endl;
+    return ok && writer.finish();
+}
+
+// Worker side
+
+static int connectTo(const std::string& host, int port) {
+    addrinfo hints = addrinfo();
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = NULL;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0) return -1;
+
+    int fd = -1;
+    for (addrinfo* address = addresses; address && fd < 0; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    return fd;
+}
+
+bool runTileWorker(const std::string& host, int port, const TileJobFunction& setup, const TileRenderFunction& render) {
+    int fd = connectTo(host, port);
+    if (fd < 0) {
+        std::cerr << "Failed to connect to " << host << ":" << port << std::endl;
+        return false;
+    }
+    int yes = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+    bool ok = false;
+    std::vector<unsigned char> payload;
+    std::vector<float> rgba;
+    MessageHeader header;
+    while (receiveAll(fd, &header, sizeof(header))) {
+        if (header.size < 0 || header.size > MAX_MESSAGE_SIZE) break;
+        payload.resize(header.size);
+        if (header.size > 0 && !receiveAll(fd, payload.data(), header.size)) break;
+
+        if (header.type == MESSAGE_JOB && header.size >= 24) {
+            TileJob job;
+            job.width = readInt(payload.data());
+            job.height = readInt(payload.data() + 4);
+            job.bucketSize = readInt(payload.data() + 8);
+            job.targetPasses = readInt(payload.data() + 12);
+            job.seed = readInt(payload.data() + 16);
+            job.denoise = readInt(payload.data() + 20);
+            job.sceneText.assign(payload.begin() + 24, payload.end());
+            if (!setup(job)) break;
+        } else if (header.type == MESSAGE_TILE && header.size == 4) {
+            int index = readInt(payload.data());
+            int width = 0, height = 0;
+            if (!render(index, rgba, width, height)) break;
+
+            std::vector<unsigned char> result;
+            appendInt(result, index);
+            appendInt(result, width);
+            appendInt(result, height);
+            const unsigned char* pixels = (const unsigned char*)rgba.data();
+            result.insert(result.end(), pixels, pixels + (size_t)width * height * 4 * sizeof(float));
+            if (!sendMessage(fd, MESSAGE_RESULT, result)) break;
+        } else if (header.type == MESSAGE_DONE) {
+            ok = true;
+            break;
+        } else {
+            std::cerr << "Unexpected message from the coordinator" << std::endl;
+            break;
+        }
+    }
+    if (!ok) std::cerr << "Lost the connection to the coordinator" << std::endl;
+    close(fd);
+    return ok;
+}
@@ -0,0 +1,91 @@
+#include "framepacer.h"
+#include <glad/glad.h>
+#include <algorithm>
+#include <cmath>
+
+static const double SMOOTHING = 0.25; // Weight of a new measurement in the running estimate
+
+static const int QUERY_IDLE = 0;   // Free to use
+static const int QUERY_OPEN = -1;  // Start timestamp issued, end not yet
+static const int QUERY_STALE = -2; // In flight, but measures a workload from before reset()
+
+FramePacer::FramePacer(double budgetMilliseconds, int maxPassesPerFrame)
+    : m_budgetMilliseconds(budgetMilliseconds), m_maxPassesPerFrame(std::max(1, maxPassesPerFrame)),
+      m_passesPerFrame(1), m_millisecondsPerPass(0.0), m_current(0), m_warmedUp(false), m_supported(false) {
+    for (int i = 0; i < QUERY_COUNT; ++i) {
+        m_queries[i][0] = m_queries[i][1] = 0;
+        m_queryPasses[i] = QUERY_IDLE;
+        m_queryCpuMilliseconds[i] = 0.0;
+    }
+}
+
+FramePacer::~FramePacer() {
+    if (m_supported) glDeleteQueries(QUERY_COUNT * 2, &m_queries[0][0]);
+}
+
+bool FramePacer::init() {
+    // Some drivers expose the query but don't actually count
+    int counterBits = 0;
+    glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &counterBits);
+    m_supported = counterBits > 0;
+    if (m_supported) glGenQueries(QUERY_COUNT * 2, &m_queries[0][0]);
+    return m_supported;
+}
+
+void FramePacer::reset() {
+    m_millisecondsPerPass = 0.0;
+    m_passesPerFrame = 1;
+    m_warmedUp = false;
+    // Results still in flight were measured with the old workload
+    for (int i = 0; i < QUERY_COUNT; ++i) {
+        if (m_queryPasses[i] > 0) m_queryPasses[i] = QUERY_STALE;
+    }
+}
+
+void FramePacer::beginPasses() {
+    if (!m_supported) return;
+    collectResults();
+
+    // Every query is still in flight (GPU several frames behind): render this frame unmeasured
+    if (m_queryPasses[m_current] != QUERY_IDLE) return;
+    glQueryCounter(m_queries[m_current][0], GL_TIMESTAMP);
+    m_queryPasses[m_current] = QUERY_OPEN;
+    m_passesStart = std::chrono::steady_clock::now();
+}
+
+void FramePacer::endPasses(int passesRendered) {
+    if (!m_supported || m_queryPasses[m_current] != QUERY_OPEN) return;
+    glQueryCounter(m_queries[m_current][1], GL_TIMESTAMP);
+    m_queryPasses[m_current] = std::max(1, passesRendered);
+    m_queryCpuMilliseconds[m_current] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_passesStart).count();
+    m_current = (m_current + 1) % QUERY_COUNT;
+}
+
+void FramePacer::collectResults() {
+    for (int i = 0; i < QUERY_COUNT; ++i) {
+        if (m_queryPasses[i] == QUERY_IDLE || m_queryPasses[i] == QUERY_OPEN) continue;
+
+        // Timestamps complete in order, so the end one being ready means both are
+        int available = 0;
+        glGetQueryObjectiv(m_queries[i][1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) continue;
+
+        GLuint64 start = 0, end = 0;
+        glGetQueryObjectui64v(m_queries[i][0], GL_QUERY_RESULT, &start);
+        glGetQueryObjectui64v(m_queries[i][1], GL_QUERY_RESULT, &end);
+        GLuint64 nanoseconds = end > start ? end - start : 0;
+        if (m_queryPasses[i] > 0 && !m_warmedUp) {
+            m_warmedUp = true;
+        } else if (m_queryPasses[i] > 0) {
+            double sample = std::max(nanoseconds / 1.0e6, m_queryCpuMilliseconds[i]) / m_queryPasses[i];
+            m_millisecondsPerPass = (m_millisecondsPerPass == 0.0) ? sample
+                : m_millisecondsPerPass + SMOOTHING * (sample - m_millisecondsPerPass);
+        }
+        m_queryPasses[i] = QUERY_IDLE;
+    }
+
+    if (m_millisecondsPerPass > 0.0) {
+        int passes = (int)std::floor(m_budgetMilliseconds / m_millisecondsPerPass);
+        m_passesPerFrame = std::min(std::max(passes, 1), m_maxPassesPerFrame);
+    }
+}
@@ -0,0 +1,51 @@
+#include "frameproducer.h"
+
+static const int ROWS_PER_CHUNK = 8;
+
+FrameProducer::FrameProducer(int width, int height, float* const* buffers, const FrameSource& source, int threadCount,
+                             const FrameEnd& frameEnd)
+    : m_width(width), m_height(height), m_source(source), m_frameEnd(frameEnd), m_pool(threadCount),
+      m_backIndex(0), m_frontIndex(1), m_shared(2), m_running(false), m_producedFrames(0) {
+    for (int i = 0; i < BUFFER_COUNT; ++i) m_buffers[i] = buffers[i];
+}
+
+FrameProducer::~FrameProducer() {
+    stop();
+}
+
+void FrameProducer::start() {
+    if (m_running.exchange(true)) return;
+    m_thread = std::thread(&FrameProducer::produceLoop, this);
+}
+
+void FrameProducer::stop() {
+    if (!m_running.exchange(false)) return;
+    m_thread.join();
+}
+
+void FrameProducer::produceLoop() {
+    unsigned int frameIndex = 0;
+    while (m_running.load(std::memory_order_relaxed)) {
+        float* pixels = m_buffers[m_backIndex];
+        m_pool.parallelFor(m_height, ROWS_PER_CHUNK, [&](int rowBegin, int rowEnd) {
+            m_source(pixels, m_width, m_height, rowBegin, rowEnd, frameIndex);
+        });
+        if (m_frameEnd) m_frameEnd(frameIndex);
+
+        // Publish: the finished buffer goes to the middle, whatever was there becomes the next back buffer.
+        // release makes the pixel writes visible to the consumer's acquire exchange.
+        unsigned int previous = m_shared.exchange((unsigned int)m_backIndex | FRESH_BIT, std::memory_order_acq_rel);
+        m_backIndex = (int)(previous & INDEX_MASK);
+
+        frameIndex++;
+        m_producedFrames.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+int FrameProducer::acquireLatest() {
+    if (!frameReady()) return -1;
+
+    unsigned int previous = m_shared.exchange((unsigned int)m_frontIndex, std::memory_order_acq_rel);
+    m_frontIndex = (int)(previous & INDEX_MASK);
+    return m_frontIndex;
+}
@@ -0,0 +1,71 @@
+#include "framestream.h"
+#include <iostream>
+
+FrameStream::FrameStream(int width, int height)
+    : m_width(width), m_height(height), m_frameSize((size_t)width * height * 4 * sizeof(float)),
+      m_texture(0), m_buffer(0), m_mapped(NULL) {
+    for (int i = 0; i < SLOT_COUNT; ++i) m_fences[i] = 0;
+}
+
+FrameStream::~FrameStream() {
+    for (int i = 0; i < SLOT_COUNT; ++i) {
+        if (m_fences[i]) glDeleteSync(m_fences[i]);
+    }
+    if (m_mapped) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    glDeleteBuffers(1, &m_buffer);
+    glDeleteTextures(1, &m_texture);
+}
+
+bool FrameStream::init() {
+    if (!GLAD_GL_VERSION_4_4) {
+        std::cerr << "Frame streaming needs OpenGL 4.4" << std::endl;
+        return false;
+    }
+
+    // RGBA32F matches the client data exactly, so the upload is a plain copy without driver-side conversion
+    glGenTextures(1, &m_texture);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, m_width, m_height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, m_frameSize * SLOT_COUNT, NULL, flags);
+    m_mapped = (float*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, m_frameSize * SLOT_COUNT, flags);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (!m_mapped) {
+        std::cerr << "Failed to map the frame streaming buffer" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool FrameStream::slotIdle(int index) {
+    GLsync& fence = m_fences[index];
+    if (fence) {
+        // Timeout 0 only polls. The flush makes sure the fence actually gets submitted.
+        GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status == GL_TIMEOUT_EXPIRED) return false;
+        glDeleteSync(fence);
+        fence = 0;
+    }
+    return true;
+}
+
+void FrameStream::upload(int index) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    // With a bound unpack buffer the pointer argument is an offset into it
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RGBA, GL_FLOAT, (void*)(m_frameSize * index));
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (m_fences[index]) glDeleteSync(m_fences[index]);
+    m_fences[index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
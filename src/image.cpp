@@ -0,0 +1,696 @@
+#include "image.h"
+#include <zlib.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+static bool endsWith(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// The PPM and PFM writers seek to a block's rows, so it has to lie within the image
+static bool blockInside(int x, int y, int width, int height, int imageWidth, int imageHeight) {
+    if (x >= 0 && y >= 0 && width >= 0 && height >= 0 && width <= imageWidth - x && height <= imageHeight - y) return true;
+    std::cerr << "Image block outside the " << imageWidth << "x" << imageHeight << " image" << std::endl;
+    return false;
+}
+
+// Binary PPM (P6). Values are clamped to [0, 1] without a transfer curve, the same as the window shows them.
+class PpmWriter : public ImageWriter {
+public:
+    PpmWriter(const std::string& path, int width, int height, int channels)
+        : m_file(path.c_str(), std::ios::binary), m_width(width), m_height(height), m_channels(channels), m_nextRow(0),
+          m_row(width * 3) {
+        m_file << "P6\n" << width << " " << height << "\n255\n";
+        m_dataStart = m_file.tellp();
+    }
+
+    bool good() const { return (bool)m_file; }
+
+    bool writeRows(const float* rgba, int rowCount) {
+        m_nextRow += rowCount;
+        return writeTile(0, m_nextRow - rowCount, m_width, rowCount, rgba);
+    }
+
+    bool writeTile(int x, int y, int width, int height, const float* rgba) {
+        if (!blockInside(x, y, width, height, m_width, m_height)) return false;
+        for (int row = 0; row < height; ++row) {
+            for (int i = 0; i < width; ++i) {
+                for (int c = 0; c < 3; ++c) {
+                    float value = std::min(std::max(rgba[i * m_channels + c], 0.0f), 1.0f);
+                    m_row[i * 3 + c] = (unsigned char)(value * 255.0f + 0.5f);
+                }
+            }
+            m_file.seekp(m_dataStart + ((std::streamoff)(y + row) * m_width + x) * 3);
+            m_file.write((const char*)m_row.data(), (std::streamsize)width * 3);
+            rgba += (size_t)width * m_channels;
+        }
+        return (bool)m_file;
+    }
+
+    bool finish() {
+        m_file.close();
+        return !m_file.fail();
+    }
+
+private:
+    std::ofstream m_file;
+    int m_width;
+    int m_height;
+    int m_channels; // Floats per pixel of the rows handed in
+    int m_nextRow;
+    std::streamoff m_dataStart;
+    std::vector<unsigned char> m_row;
+};
+
+// Portable float map, little-endian RGB floats. PFM stores the bottom row first, so every row
+// is written straight to its final position instead of buffering the image to flip it.
+class PfmWriter : public ImageWriter {
+public:
+    PfmWriter(const std::string& path, int width, int height, int channels)
+        : m_file(path.c_str(), std::ios::binary), m_width(width), m_height(height), m_channels(channels), m_nextRow(0),
+          m_row(width * 3) {
+        m_file << "PF\n" << width << " " << height << "\n-1.0\n";
+        m_dataStart = m_file.tellp();
+    }
+
+    bool good() const { return (bool)m_file; }
+
+    bool writeRows(const float* rgba, int rowCount) {
+        m_nextRow += rowCount;
+        return writeTile(0, m_nextRow - rowCount, m_width, rowCount, rgba);
+    }
+
+    bool writeTile(int x, int y, int width, int height, const float* rgba) {
+        if (!blockInside(x, y, width, height, m_width, m_height)) return false;
+        for (int row = 0; row < height; ++row) {
+            for (int i = 0; i < width; ++i) {
+                for (int c = 0; c < 3; ++c) m_row[i * 3 + c] = rgba[i * m_channels + c];
+            }
+            std::streamoff pixel = (std::streamoff)(m_height - 1 - (y + row)) * m_width + x;
+            m_file.seekp(m_dataStart + pixel * 3 * (std::streamoff)sizeof(float));
+            m_file.write((const char*)m_row.data(), (std::streamsize)width * 3 * sizeof(float));
+            rgba += (size_t)width * m_channels;
+        }
+        return (bool)m_file;
+    }
+
+    bool finish() {
+        m_file.close();
+        return !m_file.fail();
+    }
+
+private:
+    std::ofstream m_file;
+    int m_width;
+    int m_height;
+    int m_channels;
+    int m_nextRow;
+    std::streamoff m_dataStart;
+    std::vector<float> m_row;
+};
+
+// IEEE half with round-to-nearest-even, overflowing to infinity
+static unsigned short floatToHalf(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t exponent = (bits >> 23) & 0xff;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (exponent == 0xff) return (unsigned short)(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    int halfExponent = (int)exponent - 127 + 15;
+    if (halfExponent >= 31) return (unsigned short)(sign | 0x7c00);
+
+    uint32_t half;
+    int shift;
+    if (halfExponent <= 0) {
+        // Subnormal, the implicit leading one becomes explicit
+        if (halfExponent < -10) return (unsigned short)sign;
+        mantissa |= 0x800000;
+        shift = 14 - halfExponent;
+        half = mantissa >> shift;
+    } else {
+        shift = 13;
+        half = ((uint32_t)halfExponent << 10) | (mantissa >> shift);
+    }
+    // A carry out of the mantissa correctly bumps the exponent
+    uint32_t remainder = mantissa & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    if (remainder > halfway || (remainder == halfway && (half & 1))) half++;
+    return (unsigned short)(sign | half);
+}
+
+static void appendBytes(std::vector<unsigned char>& out, uint64_t value, int byteCount) {
+    for (int i = 0; i < byteCount; ++i) out.push_back((unsigned char)(value >> (8 * i)));
+}
+
+static void appendString(std::vector<unsigned char>& out, const char* text) {
+    out.insert(out.end(), text, text + std::strlen(text) + 1);
+}
+
+static void appendAttribute(std::vector<unsigned char>& out, const char* name, const char* type, const std::vector<unsigned char>& value) {
+    appendString(out, name);
+    appendString(out, type);
+    appendBytes(out, value.size(), 4);
+    out.insert(out.end(), value.begin(), value.end());
+}
+
+// A channel of an EXR file: its name and where its value sits in the pixels handed to the writer
+struct ExrChannel {
+    const char* name;
+    int offset;
+    bool halfFloat;
+};
+
+// Single-part OpenEXR with B, G, R (spp and AOV) channels, either as scanlines or as tiles.
+// Scanline files gather one compression block (16 rows for ZIP, 1 otherwise) and write it as soon as
+// it is full. Tiled files write every tile as it arrives, in any order. In both cases the offset table
+// is left zeroed after the header and filled in by finish(), so memory use is one block or tile,
+// whatever the image size.
+class ExrWriter : public ImageWriter {
+public:
+    ExrWriter(const std::string& path, int width, int height, bool halfFloat, ExrCompression compression, int tileSize,
+              bool sampleCounts, bool aovs)
+        : m_file(path.c_str(), std::ios::binary), m_width(width), m_height(height),
+          m_pixelFloats(aovs ? IMAGE_CHANNELS_WITH_AOVS : IMAGE_CHANNELS), m_compression(compression),
+          m_tileSize(tileSize), m_rowsPerBlock(compression == EXR_ZIP_COMPRESSION ? 16 : 1), m_nextRow(0),
+          m_blockRows(0) {
+        // Sorted by name, the order the header lists them in and the data stores them in. Normals, depth
+        // and object indices are always floats, half floats lose too much of them; so are sample counts,
+        // which half floats only count exactly up to 2048.
+        const ExrChannel channels[] = {
+            {"B", 2, halfFloat},        {"G", 1, halfFloat},        {"N.X", 8, false},         {"N.Y", 9, false},
+            {"N.Z", 10, false},         {"R", 0, halfFloat},        {"Z", 11, false},          {"albedo.B", 6, halfFloat},
+            {"albedo.G", 5, halfFloat}, {"albedo.R", 4, halfFloat}, {"id", 7, false},          {"spp", 3, false}};
+        for (size_t i = 0; i < sizeof(channels) / sizeof(channels[0]); ++i) {
+            bool isAov = channels[i].offset >= IMAGE_CHANNELS;
+            bool isSampleCount = channels[i].offset == 3;
+            if ((isAov && !aovs) || (isSampleCount && !sampleCounts)) continue;
+            m_channels.push_back(channels[i]);
+        }
+        m_tilesX = tileSize > 0 ? (width + tileSize - 1) / tileSize : 1;
+        int chunkCount = tileSize > 0 ? m_tilesX * ((height + tileSize - 1) / tileSize)
+                                      : (height + m_rowsPerBlock - 1) / m_rowsPerBlock;
+        m_offsets.assign(chunkCount, 0);
+        writeHeader();
+    }
+
+    bool good() const { return (bool)m_file; }
+
+    bool writeRows(const float* rgba, int rowCount) {
+        if (m_tileSize > 0) {
+            std::cerr << "Tiled EXR files are written tile by tile" << std::endl;
+            return false;
+        }
+        for (int y = 0; y < rowCount; ++y) {
+            appendRow(rgba, m_width);
+            rgba += (size_t)m_width * m_pixelFloats;
+            m_nextRow++;
+            m_blockRows++;
+            if (m_blockRows == m_rowsPerBlock || m_nextRow == m_height) {
+                int firstRow = m_nextRow - m_blockRows;
+                if (!writeChunk(firstRow / m_rowsPerBlock, std::vector<int>(1, firstRow))) return false;
+                m_blockRows = 0;
+            }
+        }
+        return (bool)m_file;
+    }
+
+    bool writeTile(int x, int y, int width, int height, const float* rgba) {
+        if (m_tileSize == 0 || x % m_tileSize != 0 || y % m_tileSize != 0 ||
+            width != std::min(m_tileSize, m_width - x) || height != std::min(m_tileSize, m_height - y)) {
+            std::cerr << "EXR tiles have to match the " << m_tileSize << " pixel tile grid" << std::endl;
+            return false;
+        }
+        for (int row = 0; row < height; ++row) appendRow(rgba + (size_t)row * width * m_pixelFloats, width);
+
+        // Tile coordinates, then level coordinates of the single mip level
+        std::vector<int> prefix(4, 0);
+        prefix[0] = x / m_tileSize;
+        prefix[1] = y / m_tileSize;
+        return writeChunk(prefix[1] * m_tilesX + prefix[0], prefix);
+    }
+
+    bool finish() {
+        if (std::count(m_offsets.begin(), m_offsets.end(), 0) > 0) {
+            std::cerr << "EXR file is missing blocks" << std::endl;
+            m_file.close();
+            return false;
+        }
+        std::vector<unsigned char> table;
+        for (size_t i = 0; i < m_offsets.size(); ++i) appendBytes(table, m_offsets[i], 8);
+        m_file.seekp(m_offsetTableStart);
+        m_file.write((const char*)table.data(), table.size());
+        m_file.close();
+        return !m_file.fail();
+    }
+
+private:
+    void writeHeader() {
+        std::vector<unsigned char> header;
+        appendBytes(header, 20000630, 4);                   // Magic number
+        appendBytes(header, m_tileSize > 0 ? 0x202 : 2, 4); // Version 2, single part, tiled flag
+
+        std::vector<unsigned char> channels;
+        for (size_t i = 0; i < m_channels.size(); ++i) {
+            appendString(channels, m_channels[i].name);
+            appendBytes(channels, m_channels[i].halfFloat ? 1 : 2, 4); // HALF or FLOAT
+            appendBytes(channels, 0, 4);                               // pLinear and reserved bytes
+            appendBytes(channels, 1, 4);                               // x sampling
+            appendBytes(channels, 1, 4);                               // y sampling
+        }
+        channels.push_back(0);
+        appendAttribute(header, "channels", "chlist", channels);
+
+        appendAttribute(header, "compression", "compression", std::vector<unsigned char>(1, (unsigned char)m_compression));
+
+        std::vector<unsigned char> window;
+        appendBytes(window, 0, 4);
+        appendBytes(window, 0, 4);
+        appendBytes(window, m_width - 1, 4);
+        appendBytes(window, m_height - 1, 4);
+        appendAttribute(header, "dataWindow", "box2i", window);
+        appendAttribute(header, "displayWindow", "box2i", window);
+
+        appendAttribute(header, "lineOrder", "lineOrder", std::vector<unsigned char>(1, 0)); // INCREASING_Y
+
+        std::vector<unsigned char> one;
+        float oneValue = 1.0f;
+        uint32_t oneBits;
+        std::memcpy(&oneBits, &oneValue, sizeof(oneBits));
+        appendBytes(one, oneBits, 4);
+        appendAttribute(header, "pixelAspectRatio", "float", one);
+        appendAttribute(header, "screenWindowCenter", "v2f", std::vector<unsigned char>(8, 0));
+        appendAttribute(header, "screenWindowWidth", "float", one);
+
+        if (m_tileSize > 0) {
+            std::vector<unsigned char> tiles;
+            appendBytes(tiles, m_tileSize, 4);
+            appendBytes(tiles, m_tileSize, 4);
+            tiles.push_back(0); // ONE_LEVEL, no mip maps
+            appendAttribute(header, "tiles", "tiledesc", tiles);
+        }
+        header.push_back(0);
+
+        m_file.write((const char*)header.data(), header.size());
+        m_offsetTableStart = m_file.tellp();
+        std::vector<unsigned char> table(m_offsets.size() * 8, 0);
+        m_file.write((const char*)table.data(), table.size());
+    }
+
+    // Channels are stored one after the other per row, in the alphabetical order of the header
+    void appendRow(const float* rgba, int width) {
+        for (size_t c = 0; c < m_channels.size(); ++c) {
+            for (int x = 0; x < width; ++x) {
+                float value = rgba[x * m_pixelFloats + m_channels[c].offset];
+                if (m_channels[c].halfFloat) {
+                    appendBytes(m_block, floatToHalf(value), 2);
+                } else {
+                    uint32_t bits;
+                    std::memcpy(&bits, &value, sizeof(bits));
+                    appendBytes(m_block, bits, 4);
+                }
+            }
+        }
+    }
+
+    // Compresses the gathered pixel data and writes it after the given chunk header integers
+    bool writeChunk(int index, const std::vector<int>& prefix) {
+        const unsigned char* data = m_block.data();
+        size_t size = m_block.size();
+
+        if (m_compression != EXR_NO_COMPRESSION) {
+            // Even bytes first, then odd bytes, then byte deltas: what OpenEXR's ZIP codec expects,
+            // and it gives zlib long runs for the slowly varying high bytes
+            m_scratch.resize(size);
+            size_t half = (size + 1) / 2;
+            for (size_t i = 0; i < size; ++i) m_scratch[(i % 2 == 0) ? i / 2 : half + i / 2] = m_block[i];
+            for (size_t i = size - 1; i > 0; --i) m_scratch[i] = (unsigned char)(m_scratch[i] - m_scratch[i - 1] + 128);
+
+            uLongf compressedSize = compressBound(size);
+            m_compressed.resize(compressedSize);
+            if (compress(m_compressed.data(), &compressedSize, m_scratch.data(), size) != Z_OK) return false;
+            // Blocks that don't shrink are stored raw, readers tell them apart by their size
+            if (compressedSize < size) {
+                data = m_compressed.data();
+                size = compressedSize;
+            }
+        }
+
+        std::vector<unsigned char> chunkHeader;
+        for (size_t i = 0; i < prefix.size(); ++i) appendBytes(chunkHeader, (uint32_t)prefix[i], 4);
+        appendBytes(chunkHeader, size, 4);
+        m_file.seekp(0, std::ios::end);
+        m_offsets[index] = (uint64_t)m_file.tellp();
+        m_file.write((const char*)chunkHeader.data(), chunkHeader.size());
+        m_file.write((const char*)data, size);
+
+        m_block.clear();
+        return (bool)m_file;
+    }
+
+    std::ofstream m_file;
+    int m_width;
+    int m_height;
+    int m_pixelFloats;                  // Floats per pixel of the rows handed in
+    std::vector<ExrChannel> m_channels; // The ones this file stores
+    ExrCompression m_compression;
+    int m_tileSize; // 0 for a scanline file
+    int m_tilesX;
+    int m_rowsPerBlock;
+    int m_nextRow;
+    int m_blockRows;
+    std::streamoff m_offsetTableStart;
+    std::vector<uint64_t> m_offsets;
+    std::vector<unsigned char> m_block;      // Raw pixel data of the rows gathered so far
+    std::vector<unsigned char> m_scratch;    // Reordered block, before compression
+    std::vector<unsigned char> m_compressed;
+};
+
+static float halfToFloat(unsigned short half) {
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    int exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+    uint32_t bits;
+    if (exponent == 0x1f) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    } else if (exponent > 0) {
+        bits = sign | ((uint32_t)(exponent - 15 + 127) << 23) | (mantissa << 13);
+    } else if (mantissa == 0) {
+        bits = sign;
+    } else {
+        // Subnormal, shift until the leading one becomes the implicit one
+        exponent = 1;
+        while (!(mantissa & 0x400)) {
+            mantissa <<= 1;
+            exponent--;
+        }
+        bits = sign | ((uint32_t)(exponent - 15 + 127) << 23) | ((mantissa & 0x3ff) << 13);
+    }
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static uint64_t readLittleEndian(const unsigned char* bytes, int byteCount) {
+    uint64_t value = 0;
+    for (int i = byteCount - 1; i >= 0; --i) value = (value << 8) | bytes[i];
+    return value;
+}
+
+// Reads the subset of OpenEXR that ExrWriter produces. Blocks are decoded a band at a time, one
+// compression block for scanline files or one row of tiles for tiled files, and kept until the
+// rows after them are asked for.
+class ExrReader : public ImageReader {
+public:
+    explicit ExrReader(const std::string& path)
+        : m_file(path.c_str(), std::ios::binary), m_path(path), m_width(0), m_height(0), m_hasSampleCounts(false),
+          m_compression(-1), m_tileWidth(0), m_tileHeight(0), m_rowsPerBlock(1), m_bytesPerPixel(0),
+          m_bandBegin(0), m_bandRows(0) {}
+
+    bool open() {
+        if (!m_file) return fail("can't open the file");
+        unsigned char start[8];
+        if (!m_file.read((char*)start, sizeof(start)) || readLittleEndian(start, 4) != 20000630) return fail("not an OpenEXR file");
+        uint32_t version = (uint32_t)readLittleEndian(start + 4, 4);
+        // Deep data and multi-part files are something else entirely
+        if ((version & 0xff) != 2 || (version & 0x1800)) return fail("unsupported OpenEXR version or file type");
+        bool tiled = (version & 0x200) != 0;
+
+        int dataWindow[4] = {0, 0, -1, -1};
+        for (;;) {
+            std::string name = readString();
+            if (name.empty()) break;
+            std::string type = readString();
+            unsigned char sizeBytes[4];
+            if (!m_file.read((char*)sizeBytes, 4)) return fail("truncated header");
+            std::vector<unsigned char> value(readLittleEndian(sizeBytes, 4));
+            if (!m_file.read((char*)value.data(), value.size())) return fail("truncated header");
+
+            if (name == "channels") {
+                if (!parseChannels(value)) return fail("unsupported channels, expected half or float channels without subsampling");
+            } else if (name == "compression" && value.size() == 1) {
+                m_compression = value[0];
+            } else if (name == "dataWindow" && value.size() == 16) {
+                for (int i = 0; i < 4; ++i) dataWindow[i] = (int)(int32_t)readLittleEndian(value.data() + i * 4, 4);
+            } else if (name == "tiles" && value.size() == 9) {
+                m_tileWidth = (int)readLittleEndian(value.data(), 4);
+                m_tileHeight = (int)readLittleEndian(value.data() + 4, 4);
+                if ((value[8] & 0xf) != 0) return fail("mip mapped tiles are not supported");
+            }
+        }
+
+        m_width = dataWindow[2] - dataWindow[0] + 1;
+        m_height = dataWindow[3] - dataWindow[1] + 1;
+        if (m_width <= 0 || m_height <= 0 || m_bytesPerPixel == 0) return fail("missing or empty data window or channels");
+        if (m_compression == EXR_ZIP_COMPRESSION) m_rowsPerBlock = 16;
+        else if (m_compression != EXR_NO_COMPRESSION && m_compression != EXR_ZIPS_COMPRESSION) return fail("unsupported compression, expected none, ZIPS or ZIP");
+        if (tiled && (m_tileWidth <= 0 || m_tileHeight <= 0)) return fail("tiled file without a tile description");
+        if (!tiled) m_tileWidth = 0;
+
+        int chunkCount = tiled ? tilesX() * ((m_height + m_tileHeight - 1) / m_tileHeight)
+                               : (m_height + m_rowsPerBlock - 1) / m_rowsPerBlock;
+        std::vector<unsigned char> table((size_t)chunkCount * 8);
+        if (!m_file.read((char*)table.data(), table.size())) return fail("truncated offset table");
+        m_offsets.resize(chunkCount);
+        for (int i = 0; i < chunkCount; ++i) m_offsets[i] = readLittleEndian(table.data() + i * 8, 8);
+        return true;
+    }
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    bool hasSampleCounts() const { return m_hasSampleCounts; }
+
+    bool readRows(int rowBegin, int rowCount, float* rgba) {
+        for (int row = rowBegin; row < rowBegin + rowCount; ++row) {
+            if (row < m_bandBegin || row >= m_bandBegin + m_bandRows) {
+                if (!decodeBand(row)) return false;
+            }
+            const float* source = m_band.data() + (size_t)(row - m_bandBegin) * m_width * 4;
+            std::copy(source, source + (size_t)m_width * 4, rgba);
+            rgba += (size_t)m_width * 4;
+        }
+        return true;
+    }
+
+private:
+    enum ChannelType {
+        CHANNEL_UINT = 0,
+        CHANNEL_HALF = 1,
+        CHANNEL_FLOAT = 2
+    };
+
+    struct Channel {
+        int type;
+        int component; // RGBA index it is read into, -1 for channels that are skipped
+    };
+
+    bool fail(const char* message) {
+        std::cerr << m_path << ": " << message << std::endl;
+        return false;
+    }
+
+    std::string readString() {
+        std::string text;
+        char c;
+        while (m_file.get(c) && c != 0) text += c;
+        return text;
+    }
+
+    int tilesX() const { return (m_width + m_tileWidth - 1) / m_tileWidth; }
+
+    // Channels come sorted by name; R, G, B and spp are kept, anything else is skipped
+    bool parseChannels(const std::vector<unsigned char>& value) {
+        size_t position = 0;
+        while (position < value.size() && value[position] != 0) {
+            std::string name((const char*)&value[position]);
+            position += name.size() + 1;
+            if (position + 16 > value.size()) return false;
+            Channel channel;
+            channel.type = (int)readLittleEndian(&value[position], 4);
+            int xSampling = (int)readLittleEndian(&value[position + 8], 4);
+            int ySampling = (int)readLittleEndian(&value[position + 12], 4);
+            position += 16;
+            if (channel.type < CHANNEL_UINT || channel.type > CHANNEL_FLOAT || xSampling != 1 || ySampling != 1) return false;
+
+            channel.component = -1;
+            if (name == "R") channel.component = 0;
+            else if (name == "G") channel.component = 1;
+            else if (name == "B") channel.component = 2;
+            else if (name == "spp") channel.component = 3;
+            if (channel.component == 3) m_hasSampleCounts = true;
+            m_channels.push_back(channel);
+            m_bytesPerPixel += channel.type == CHANNEL_HALF ? 2 : 4;
+        }
+        return true;
+    }
+
+    // Decodes the scanline block or the row of tiles that holds `row`
+    bool decodeBand(int row) {
+        int bandHeight = m_tileWidth > 0 ? m_tileHeight : m_rowsPerBlock;
+        m_bandBegin = row - row % bandHeight;
+        m_bandRows = std::min(bandHeight, m_height - m_bandBegin);
+        m_band.assign((size_t)m_bandRows * m_width * 4, 0.0f);
+
+        if (m_tileWidth == 0) {
+            // Chunk header: y, data size
+            if (!decodeChunk(m_offsets[m_bandBegin / m_rowsPerBlock], 2, 0, m_width)) {
+                m_bandRows = 0;
+                return false;
+            }
+            return true;
+        }
+        // Chunk header: tile x, tile y, level x, level y, data size
+        for (int tile = 0; tile < tilesX(); ++tile) {
+            int left = tile * m_tileWidth;
+            int index = (m_bandBegin / m_tileHeight) * tilesX() + tile;
+            if (!decodeChunk(m_offsets[index], 5, left, std::min(m_tileWidth, m_width - left))) {
+                m_bandRows = 0;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Reads the chunk at offset and unpacks its m_bandRows x width pixels into the band at column left
+    bool decodeChunk(uint64_t offset, int headerInts, int left, int width) {
+        std::vector<unsigned char> header(headerInts * 4);
+        m_file.seekg((std::streamoff)offset);
+        if (offset == 0 || !m_file.read((char*)header.data(), header.size())) return fail("missing or truncated block");
+        size_t size = (size_t)readLittleEndian(&header[(headerInts - 1) * 4], 4);
+        size_t expected = (size_t)m_bandRows * width * m_bytesPerPixel;
+        if (size > expected) return fail("corrupt block size");
+        m_compressed.resize(size);
+        if (!m_file.read((char*)m_compressed.data(), size)) return fail("truncated block");
+
+        const unsigned char* data = m_compressed.data();
+        if (size < expected) {
+            // Undo what ExrWriter::writeChunk() did: zlib, byte deltas, even/odd byte split
+            m_scratch.resize(expected);
+            uLongf length = expected;
+            if (m_compression == EXR_NO_COMPRESSION || uncompress(m_scratch.data(), &length, data, size) != Z_OK ||
+                length != expected) {
+                return fail("corrupt compressed block");
+            }
+            for (size_t i = 1; i < expected; ++i) m_scratch[i] = (unsigned char)(m_scratch[i - 1] + m_scratch[i] - 128);
+            m_block.resize(expected);
+            size_t half = (expected + 1) / 2;
+            for (size_t i = 0; i < expected; ++i) m_block[i] = m_scratch[(i % 2 == 0) ? i / 2 : half + i / 2];
+            data = m_block.data();
+        }
+
+        for (int row = 0; row < m_bandRows; ++row) {
+            float* out = m_band.data() + ((size_t)row * m_width + left) * 4;
+            for (size_t c = 0; c < m_channels.size(); ++c) {
+                int type = m_channels[c].type;
+                int component = m_channels[c].component;
+                for (int x = 0; x < width; ++x) {
+                    float value;
+                    if (type == CHANNEL_HALF) {
+                        value = halfToFloat((unsigned short)readLittleEndian(data, 2));
+                        data += 2;
+                    } else {
+                        uint32_t bits = (uint32_t)readLittleEndian(data, 4);
+                        if (type == CHANNEL_FLOAT) std::memcpy(&value, &bits, sizeof(value));
+                        else value = (float)bits;
+                        data += 4;
+                    }
+                    if (component >= 0) out[x * 4 + component] = value;
+                }
+            }
+        }
+        return true;
+    }
+
+    std::ifstream m_file;
+    std::string m_path;
+    int m_width;
+    int m_height;
+    bool m_hasSampleCounts;
+    int m_compression;
+    int m_tileWidth;  // 0 for a scanline file
+    int m_tileHeight;
+    int m_rowsPerBlock;
+    int m_bytesPerPixel;
+    std::vector<Channel> m_channels;
+    std::vector<uint64_t> m_offsets;
+    int m_bandBegin;
+    int m_bandRows;
+    std::vector<float> m_band;               // Decoded RGBA rows [m_bandBegin, m_bandBegin + m_bandRows)
+    std::vector<unsigned char> m_compressed;
+    std::vector<unsigned char> m_scratch;
+    std::vector<unsigned char> m_block;
+};
+
+// Writes to a temporary file next to the output and renames it into place in finish(), so a render that
+// is refused, fails or gets killed leaves the previous image at the path as it was. Without a successful
+// finish() the temporary file is removed again.
+class ReplacingWriter : public ImageWriter {
+public:
+    ReplacingWriter(std::unique_ptr<ImageWriter> writer, const std::string& temporaryPath, const std::string& path)
+        : m_writer(std::move(writer)), m_temporaryPath(temporaryPath), m_path(path) {}
+
+    ~ReplacingWriter() {
+        if (!m_writer) return;
+        m_writer.reset();
+        std::remove(m_temporaryPath.c_str());
+    }
+
+    bool writeRows(const float* rgba, int rowCount) { return m_writer->writeRows(rgba, rowCount); }
+    bool writeTile(int x, int y, int width, int height, const float* rgba) { return m_writer->writeTile(x, y, width, height, rgba); }
+
+    bool finish() {
+        bool ok = m_writer->finish();
+        m_writer.reset();
+        if (ok && std::rename(m_temporaryPath.c_str(), m_path.c_str()) == 0) return true;
+        std::remove(m_temporaryPath.c_str());
+        return false;
+    }
+
+private:
+    std::unique_ptr<ImageWriter> m_writer; // NULL once finished
+    std::string m_temporaryPath;
+    std::string m_path;
+};
+
+template <typename Writer>
+static std::unique_ptr<ImageWriter> checkOpened(Writer* writer, const std::string& path) {
+    std::unique_ptr<Writer> owned(writer);
+    if (owned->good()) return std::unique_ptr<ImageWriter>(owned.release());
+    std::cerr << "Failed to create " << path << std::endl;
+    return NULL;
+}
+
+std::unique_ptr<ImageWriter> createImageWriter(const std::string& path, int width, int height,
+                                               bool halfFloat, ExrCompression compression, int tileSize,
+                                               bool sampleCounts, bool aovs) {
+    int channels = aovs ? IMAGE_CHANNELS_WITH_AOVS : IMAGE_CHANNELS;
+    std::string temporaryPath = path + ".tmp";
+    std::unique_ptr<ImageWriter> writer;
+    if (endsWith(path, ".ppm")) {
+        writer = checkOpened(new PpmWriter(temporaryPath, width, height, channels), temporaryPath);
+    } else if (endsWith(path, ".pfm")) {
+        writer = checkOpened(new PfmWriter(temporaryPath, width, height, channels), temporaryPath);
+    } else if (endsWith(path, ".exr")) {
+        writer = checkOpened(new ExrWriter(temporaryPath, width, height, halfFloat, compression, tileSize, sampleCounts, aovs), temporaryPath);
+    } else {
+        std::cerr << "Unknown image format " << path << ", use .ppm, .pfm or .exr" << std::endl;
+        return NULL;
+    }
+    if (!writer) return NULL;
+    return std::unique_ptr<ImageWriter>(new ReplacingWriter(std::move(writer), temporaryPath, path));
+}
+
+std::unique_ptr<ImageReader> openImageReader(const std::string& path) {
+    if (!endsWith(path, ".exr")) {
+        std::cerr << "Can only read .exr images, not " << path << std::endl;
+        return NULL;
+    }
+    std::unique_ptr<ExrReader> reader(new ExrReader(path));
+    if (!reader->open()) return NULL;
+    return std::unique_ptr<ImageReader>(reader.release());
+}
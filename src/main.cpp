@@ -3,9 +3,24 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <cstdlib>
+#include "framestream.h"
+#include "frameproducer.h"
+#include "framepacer.h"
+#include "profiler.h"
+#include "renderer.h"
+#include "context.h"
+#include "texturecache.h"
+#include "tiledtexture.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 
 const unsigned int WIDTH = 800;
 const unsigned int HEIGHT = 600;
+const int TEXTURE_TILE_SIZE = 64; // Texels along a side of the tiles --texture is paged in as
+// Bands the first full-resolution pass after an interaction is split into while there is no pass time estimate yet
+const int REFINEMENT_BANDS = 8;
 
 // Vertex shader source code
 const char* vertexShaderSource = R"(
@@ -39,6 +54,35 @@ void processInput(GLFWwindow* window) {
         glfwSetWindowShouldClose(window, true);
 }
 
+// WASD moves the camera along the ground, Q and E move it down and up, the arrow keys turn it.
+// Returns true if the camera changed.
+bool updateCamera(GLFWwindow* window, Camera& camera, float seconds) {
+    const float moveSpeed = 2.0f; // Units per second
+    const float turnSpeed = 1.0f; // Radians per second
+    float forward = 0.0f, right = 0.0f, up = 0.0f, yaw = 0.0f, pitch = 0.0f;
+    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) forward += 1.0f;
+    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) forward -= 1.0f;
+    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) right += 1.0f;
+    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) right -= 1.0f;
+    if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS) up += 1.0f;
+    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS) up -= 1.0f;
+    if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS) yaw += 1.0f;
+    if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) yaw -= 1.0f;
+    if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS) pitch += 1.0f;
+    if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS) pitch -= 1.0f;
+    if (forward == 0.0f && right == 0.0f && up == 0.0f && yaw == 0.0f && pitch == 0.0f) return false;
+
+    // The camera looks down -Z, turned by yaw around Y (see Camera::getRotationMatrix())
+    float sy = std::sin(camera.yaw), cy = std::cos(camera.yaw);
+    float step = moveSpeed * seconds;
+    camera.position.x += (-sy * forward + cy * right) * step;
+    camera.position.y += up * step;
+    camera.position.z += (-cy * forward - sy * right) * step;
+    camera.yaw += yaw * turnSpeed * seconds;
+    camera.pitch = std::min(std::max(camera.pitch + pitch * turnSpeed * seconds, -1.5f), 1.5f);
+    return true;
+}
+
 // Shader compilation check
 void checkShaderCompilation(unsigned int shader) {
     int success;
@@ -50,31 +94,177 @@ void checkShaderCompilation(unsigned int shader) {
     }
 }
 
-int main() {
-    // Initialize GLFW
-    if (!glfwInit()) {
-        std::cerr << "Failed to initialize GLFW\n";
+// Runs the GPU path tracer. Each displayed frame adds as many passes as fit in frameBudget milliseconds of GPU time.
+// With reprojection, moving the camera keeps the accumulated image instead of starting over.
+// With a previewScale above 1, frames with input only trace a preview with 1/previewScale of the resolution
+// in each direction, upsampled to the window, so they stay cheap however heavy the scene. Once input
+// stops, the first full-resolution pass is traced a band of rows per frame, within the frame budget,
+// and replaces the preview band by band. Checkerboard rendering halves the cost of full-resolution passes.
+// The skybox shows up once textureLoader has decoded it, the flat sky stands in until then.
+int runPathTracer(GLFWwindow* window, TextureLoader& textureLoader, RenderBackend backend, AccumulationMode accumulation, double frameBudget,
+                  bool reprojection, bool checkerboard, int previewScale, const std::string& profilePath) {
+    Renderer renderer(WIDTH, HEIGHT, backend, accumulation);
+    renderer.setTemporalReprojection(reprojection);
+    renderer.setCheckerboard(checkerboard);
+    renderer.setTextureLoader(&textureLoader);
+    renderer.setStreamTextures(true);
+    if (!renderer.init()) {
+        std::cerr << "Failed to initialize the renderer\n";
         return -1;
     }
+    std::unique_ptr<Renderer> preview;
+    if (previewScale > 1) {
+        preview.reset(new Renderer(WIDTH / previewScale, HEIGHT / previewScale, backend, accumulation));
+        preview->setTextureLoader(&textureLoader);
+        preview->setStreamTextures(true);
+        if (!preview->init()) {
+            std::cerr << "Failed to initialize the preview renderer\n";
+            return -1;
+        }
+    }
 
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    FramePacer pacer(frameBudget);
+    if (!pacer.init()) std::cerr << "GPU timer queries unavailable, rendering one pass per frame\n";
 
-    GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, "Ray Tracer", NULL, NULL);
-    if (!window) {
-        std::cerr << "Failed to create GLFW window\n";
-        glfwTerminate();
-        return -1;
+    FrameProfiler profiler(profilePath);
+    if (!profiler.init()) return -1;
+
+    Camera camera = createDefaultCamera();
+    bool interacting = false; // The full-resolution renderer hasn't got the camera of the preview yet
+    double refinementMillisecondsPerPass = 0.0; // Pacer estimate from before the last preview, 0 = none
+    std::chrono::steady_clock::time_point lastFrame = std::chrono::steady_clock::now();
+    while (!glfwWindowShouldClose(window)) {
+        profiler.beginFrame();
+        processInput(window);
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        float frameSeconds = std::chrono::duration<float>(now - lastFrame).count();
+        lastFrame = now;
+        bool moved = updateCamera(window, camera, frameSeconds);
+        if (moved && preview) {
+            preview->setCamera(camera);
+            interacting = true;
+        } else if (moved || interacting) {
+            renderer.setCamera(camera);
+            if (interacting) {
+                // Back to full-resolution passes of another view: the pacer's results still in flight measured
+                // the old one, so it starts over. The refinement bands are sized by its last estimate meanwhile.
+                refinementMillisecondsPerPass = pacer.millisecondsPerPass();
+                pacer.reset();
+            }
+            interacting = false;
+        }
+
+        int passes = 0;
+        profiler.beginStage(STAGE_ACCUMULATION);
+        if (preview && (interacting || (renderer.refining() && preview->accumulatedPasses() == 0))) {
+            preview->renderPass();
+        } else if (preview && renderer.refining()) {
+            double millisecondsPerPass = pacer.millisecondsPerPass() > 0.0 ? pacer.millisecondsPerPass() : refinementMillisecondsPerPass;
+            int rows = millisecondsPerPass > 0.0 ? (int)(HEIGHT * frameBudget / millisecondsPerPass) : HEIGHT / REFINEMENT_BANDS;
+            passes = renderer.renderPassRows(rows) ? 1 : 0;
+        } else {
+            passes = pacer.passesPerFrame();
+            pacer.beginPasses();
+            for (int i = 0; i < passes; ++i) renderer.renderPass();
+            pacer.endPasses(passes);
+        }
+        profiler.endStage();
+        profiler.setPasses(passes);
+
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        profiler.beginStage(STAGE_OUTPUT);
+        // The refined rows of the full-resolution pass are drawn over the preview
+        if (preview && (interacting || renderer.refining())) preview->present(framebufferWidth, framebufferHeight);
+        if (!interacting) renderer.present(framebufferWidth, framebufferHeight);
+        profiler.endStage();
+
+        glfwSwapBuffers(window);
+        glfwPollEvents();
+        profiler.endFrame();
     }
-    glfwMakeContextCurrent(window);
+    return 0;
+}
 
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+// Runs the GPU path tracer into its FBOs without any window, for display-less render nodes
+int runHeadless(TextureLoader& textureLoader, RenderBackend backend, AccumulationMode accumulation, bool checkerboard, int passes) {
+    HeadlessContext context;
+    if (!context.create(4, 3)) return -1;
+    if (!gladLoadGLLoader((GLADloadproc)HeadlessContext::getProcAddress)) {
         std::cerr << "Failed to initialize GLAD\n";
         return -1;
     }
+    std::cout << "Headless context: " << context.description() << ", " << glGetString(GL_RENDERER) << "\n";
 
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    Renderer renderer(WIDTH, HEIGHT, backend, accumulation);
+    renderer.setCheckerboard(checkerboard);
+    renderer.setTextureLoader(&textureLoader);
+    if (!renderer.init()) {
+        std::cerr << "Failed to initialize the renderer\n";
+        return -1;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < passes; ++i) renderer.renderPass();
+    glFinish();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << renderer.accumulatedPasses() << " passes in " << seconds << " s ("
+              << renderer.accumulatedPasses() / seconds << " passes/s)\n";
+    return 0;
+}
+
+// Gradient test pattern. Called for a band of rows from several threads at once; the inner loop
+// is plain strided stores with no branches, so the compiler can vectorize it.
+void generateGradient(float* pixels, int width, int height, int rowBegin, int rowEnd, unsigned int frameIndex) {
+    (void)frameIndex;
+    const float inverseWidth = 1.0f / width;
+    for (int y = rowBegin; y < rowEnd; ++y) {
+        float* row = pixels + (size_t)y * width * 4;
+        const float green = static_cast<float>(y) / height;
+        for (int x = 0; x < width; ++x) {
+            row[x * 4 + 0] = x * inverseWidth; // Red
+            row[x * 4 + 1] = green;            // Green
+            row[x * 4 + 2] = 0.2f;             // Blue
+            row[x * 4 + 3] = 1.0f;
+        }
+    }
+}
+
+// Flies over a texture, zooming from a whole tile of it down to a few texels per pixel and back, so the
+// frames touch every mip level and far more tiles than fit the budget at the magnified end.
+void generateTextureView(TiledTexture& texture, float* pixels, int width, int height, int rowBegin, int rowEnd, unsigned int frameIndex) {
+    float t = frameIndex * 0.01f;
+    float spanU = std::pow(2.0f, 3.0f * std::sin(t) - 3.0f); // Visible fraction of the texture's width
+    float spanV = spanU * height / width * texture.width(0) / texture.height(0);
+    float centerU = 0.5f + 0.25f * std::cos(t * 0.7f);
+    float centerV = 0.5f + 0.25f * std::sin(t * 0.5f);
+    float lod = std::log2(std::max(spanU * texture.width(0) / width, 1.0f));
+    TileCounts counts = {0, 0, 0};
+    for (int y = rowBegin; y < rowEnd; ++y) {
+        float* row = pixels + (size_t)y * width * 4;
+        float v = centerV + (0.5f - (y + 0.5f) / height) * spanV; // Row 0 is the bottom of the window
+        for (int x = 0; x < width; ++x) {
+            float u = centerU + ((x + 0.5f) / width - 0.5f) * spanU;
+            texture.sample(u, v, lod, row + x * 4, counts);
+        }
+    }
+    texture.addCounts(counts);
+}
+
+// Displays frames produced on the CPU. Production runs on its own thread pool, so a slow frame
+// never holds up input handling or buffer swaps here. With a texture, the frames show it through a
+// TiledTexture holding at most textureBudget bytes of tiles, otherwise a gradient.
+int runCpuFrames(GLFWwindow* window, int threadCount, const std::string& profilePath, const std::shared_ptr<TextureRequest>& texture,
+                 size_t textureBudget) {
+    std::unique_ptr<TiledTexture> tiles;
+    if (texture) {
+        if (!texture->wait()) {
+            std::cerr << "Failed to load texture " << texture->path() << ": " << texture->error() << "\n";
+            return -1;
+        }
+        tiles.reset(new TiledTexture(texture->image(), TEXTURE_TILE_SIZE, textureBudget));
+    }
 
     // Create and compile shaders
     unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
@@ -129,33 +319,48 @@ int main() {
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
     glEnableVertexAttribArray(1);
 
-    // Create texture for the pixel data
-    unsigned int texture;
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    // Texture for the pixel data, fed through persistently mapped pixel buffers
+    FrameStream frameStream(WIDTH, HEIGHT);
+    if (!frameStream.init()) return -1;
+
+    FrameProfiler profiler(profilePath);
+    if (!profiler.init()) return -1;
 
-    // Pixel data buffer
-    std::vector<float> pixels(WIDTH * HEIGHT * 3);
+    FrameSource source = generateGradient;
+    FrameEnd frameEnd;
+    if (tiles) {
+        TiledTexture* view = tiles.get();
+        source = [view](float* pixels, int width, int height, int rowBegin, int rowEnd, unsigned int frameIndex) {
+            generateTextureView(*view, pixels, width, height, rowBegin, rowEnd, frameIndex);
+        };
+        frameEnd = [view](unsigned int) { view->endFrame(); };
+    }
+    static_assert(FrameStream::SLOT_COUNT == FrameProducer::BUFFER_COUNT, "one upload slot per frame buffer");
+    float* slots[FrameStream::SLOT_COUNT];
+    for (int i = 0; i < FrameStream::SLOT_COUNT; ++i) slots[i] = frameStream.slot(i);
+    FrameProducer producer(WIDTH, HEIGHT, slots, source, threadCount, frameEnd);
+    producer.start();
 
     while (!glfwWindowShouldClose(window)) {
+        profiler.beginFrame();
         processInput(window);
 
-        // Update pixel data (generate gradient)
-        for (int y = 0; y < HEIGHT; ++y) {
-            for (int x = 0; x < WIDTH; ++x) {
-                int pixelIndex = (y * WIDTH + x) * 3;
-                pixels[pixelIndex + 0] = static_cast<float>(x) / WIDTH;    // Red
-                pixels[pixelIndex + 1] = static_cast<float>(y) / HEIGHT;   // Green
-                pixels[pixelIndex + 2] = 0.2f;                            // Blue
+        // The producer renders into the upload slots, taking a frame hands the slot shown so far back to
+        // it. Only do that once the GPU is done uploading from that slot; until then keep showing it, the
+        // producer will have an even newer frame ready next time.
+        if (producer.frameReady() && frameStream.slotIdle(producer.frontBuffer())) {
+            int slot = producer.acquireLatest();
+            profiler.beginStage(STAGE_UPLOAD);
+            frameStream.upload(slot);
+            profiler.endStage();
+            if (tiles) {
+                TileStats stats = tiles->lastFrameStats();
+                profiler.setTileStats(stats.hits, stats.misses, stats.bypassed, stats.evictions);
             }
         }
+        glBindTexture(GL_TEXTURE_2D, frameStream.texture());
 
-        // Update texture with new pixel data
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, WIDTH, HEIGHT, 0, GL_RGB, GL_FLOAT, pixels.data());
-
+        profiler.beginStage(STAGE_OUTPUT);
         glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT);
 
@@ -163,18 +368,150 @@ int main() {
         glUseProgram(shaderProgram);
         glBindVertexArray(VAO);
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        profiler.endStage();
 
         glfwSwapBuffers(window);
         glfwPollEvents();
+        profiler.endFrame();
     }
 
+    producer.stop();
+
     // Cleanup
     glDeleteVertexArrays(1, &VAO);
     glDeleteBuffers(1, &VBO);
     glDeleteBuffers(1, &EBO);
     glDeleteProgram(shaderProgram);
-    glDeleteTextures(1, &texture);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    // "cpu" shows the CPU-generated frame, "fragment" and "compute" run the GPU path tracer
+    std::string backendName = "cpu";
+    // "sum" and "average" accumulate in RGBA32F, "half" is a running average in RGBA16F
+    std::string accumulationName = "sum";
+    int threadCount = 0; // CPU frame production threads, 0 = all hardware threads
+    // GPU time per displayed frame spent on accumulation passes. Leaves headroom for presenting at 60 Hz.
+    double frameBudget = 14.0;
+    std::string profilePath; // Per-frame stage timings, CSV or (.json/.jsonl) JSON lines
+    bool headless = false;
+    int headlessPasses = 64;
+    bool reprojection = true; // Reproject the accumulation when the camera moves instead of starting over
+    int previewScale = 4;     // Resolution divider while the camera moves, 1 = always full resolution
+    bool checkerboard = false; // Trace every other pixel per pass, compute backend only
+    std::string textureCache = defaultTextureCacheDirectory(); // Decoded textures with mips, "none" decodes every time
+    std::string texturePath;   // Shown by the CPU backend through tiles paged in on demand
+    int textureBudget = 256;   // Megabytes of resident texture tiles
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--backend" && i + 1 < argc) {
+            backendName = argv[++i];
+        } else if (arg == "--accumulation" && i + 1 < argc) {
+            accumulationName = argv[++i];
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threadCount = std::atoi(argv[++i]);
+        } else if (arg == "--frame-budget" && i + 1 < argc) {
+            frameBudget = std::atof(argv[++i]);
+        } else if (arg == "--profile" && i + 1 < argc) {
+            profilePath = argv[++i];
+        } else if (arg == "--headless") {
+            headless = true;
+        } else if (arg == "--passes" && i + 1 < argc) {
+            headlessPasses = std::atoi(argv[++i]);
+        } else if (arg == "--no-reprojection") {
+            reprojection = false;
+        } else if (arg == "--preview-scale" && i + 1 < argc) {
+            previewScale = std::atoi(argv[++i]);
+        } else if (arg == "--checkerboard") {
+            checkerboard = true;
+        } else if (arg == "--texture-cache" && i + 1 < argc) {
+            textureCache = argv[++i];
+        } else if (arg == "--texture" && i + 1 < argc) {
+            texturePath = argv[++i];
+        } else if (arg == "--texture-budget" && i + 1 < argc) {
+            textureBudget = std::atoi(argv[++i]);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--backend cpu|fragment|compute] [--accumulation sum|average|half] [--threads N] [--frame-budget MS] [--profile FILE] [--no-reprojection] [--preview-scale N] [--checkerboard] [--texture-cache DIR|none] [--texture FILE [--texture-budget MB]] [--headless [--passes N]]\n";
+            return -1;
+        }
+    }
+    if (previewScale < 1) {
+        std::cerr << "--preview-scale must be at least 1\n";
+        return -1;
+    }
+    if (backendName != "cpu" && backendName != "fragment" && backendName != "compute") {
+        std::cerr << "Unknown backend " << backendName << "\n";
+        return -1;
+    }
+    AccumulationMode accumulation = ACCUMULATE_SUM;
+    if (accumulationName == "average") accumulation = ACCUMULATE_AVERAGE;
+    else if (accumulationName == "half") accumulation = ACCUMULATE_AVERAGE_HALF;
+    else if (accumulationName != "sum") {
+        std::cerr << "Unknown accumulation mode " << accumulationName << "\n";
+        return -1;
+    }
+    bool gpuBackend = backendName != "cpu";
+    RenderBackend backend = backendName == "compute" ? BACKEND_COMPUTE : BACKEND_FRAGMENT;
+    if (checkerboard && backendName != "compute") {
+        std::cerr << "--checkerboard needs --backend compute\n";
+        return -1;
+    }
+    if (!texturePath.empty() && (gpuBackend || textureBudget < 1)) {
+        std::cerr << "--texture needs --backend cpu and a --texture-budget of at least 1 MB\n";
+        return -1;
+    }
+
+    // The skybox decodes while the context is created, the renderers take the request over
+    TextureLoader textureLoader(0, textureCache == "none" ? "" : textureCache);
+    std::shared_ptr<TextureRequest> skybox;
+    if (gpuBackend) skybox = Renderer::loadSkybox(textureLoader, createDefaultScene().skyboxPath);
+    std::shared_ptr<TextureRequest> texture;
+    if (!texturePath.empty()) texture = textureLoader.load(texturePath, 0, true);
+
+    // No GLFW at all in headless mode, glfwInit() would fail without a display server
+    if (headless) {
+        if (!gpuBackend) {
+            std::cerr << "Headless mode runs the GPU path tracer, use --backend fragment or compute\n";
+            return -1;
+        }
+        return runHeadless(textureLoader, backend, accumulation, checkerboard, headlessPasses);
+    }
+
+    // Initialize GLFW
+    if (!glfwInit()) {
+        std::cerr << "Failed to initialize GLFW\n";
+        return -1;
+    }
+
+    // The path tracer needs GL 4.3 (std430 buffers, compute shaders, image load/store),
+    // CPU frame streaming needs 4.4 (persistently mapped buffers)
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, gpuBackend ? 3 : 4);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+    GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, "Ray Tracer", NULL, NULL);
+    if (!window) {
+        std::cerr << "Failed to create GLFW window\n";
+        glfwTerminate();
+        return -1;
+    }
+    glfwMakeContextCurrent(window);
+
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+        std::cerr << "Failed to initialize GLAD\n";
+        return -1;
+    }
 
+    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+
+    if (gpuBackend) {
+        int result = runPathTracer(window, textureLoader, backend, accumulation, frameBudget, reprojection, checkerboard, previewScale,
+                                   profilePath);
+        glfwTerminate();
+        return result;
+    }
+
+    int result = runCpuFrames(window, threadCount, profilePath, texture, (size_t)textureBudget << 20);
     glfwTerminate();
-    return 0;
+    return result;
 }
\ No newline at end of file
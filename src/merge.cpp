@@ -0,0 +1,100 @@
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "image.h"
+
+// Rows read from every input and written to the output at a time
+static const int BAND_ROWS = 16;
+
+// Combines renders of the same frame, made with different --seed values, into one image. Every pixel
+// is the sample-weighted average of the inputs and carries the summed sample count, so merged files
+// can be merged again as more renders come in.
+int main(int argc, char** argv) {
+    std::string outputPath;
+    bool halfFloat = false;
+    std::string compressionName = "zip";
+    std::vector<std::string> inputPaths;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--output" && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (arg == "--half") {
+            halfFloat = true;
+        } else if (arg == "--compression" && i + 1 < argc) {
+            compressionName = argv[++i];
+        } else if (arg.compare(0, 2, "--") != 0) {
+            inputPaths.push_back(arg);
+        } else {
+            outputPath.clear();
+            break;
+        }
+    }
+    if (outputPath.empty() || inputPaths.empty() ||
+        (compressionName != "none" && compressionName != "zips" && compressionName != "zip")) {
+        std::cerr << "Usage: " << argv[0] << " --output FILE [--half] [--compression none|zips|zip] INPUT.exr...\n";
+        return -1;
+    }
+    ExrCompression compression = EXR_ZIP_COMPRESSION;
+    if (compressionName == "none") compression = EXR_NO_COMPRESSION;
+    else if (compressionName == "zips") compression = EXR_ZIPS_COMPRESSION;
+
+    std::vector<std::unique_ptr<ImageReader> > inputs;
+    for (size_t i = 0; i < inputPaths.size(); ++i) {
+        std::unique_ptr<ImageReader> input = openImageReader(inputPaths[i]);
+        if (!input) return -1;
+        if (!input->hasSampleCounts()) {
+            std::cerr << inputPaths[i] << " has no sample counts, only EXR renders of the batch renderer can be merged\n";
+            return -1;
+        }
+        if (!inputs.empty() && (input->width() != inputs[0]->width() || input->height() != inputs[0]->height())) {
+            std::cerr << inputPaths[i] << " is " << input->width() << "x" << input->height() << ", "
+                      << inputPaths[0] << " is " << inputs[0]->width() << "x" << inputs[0]->height() << "\n";
+            return -1;
+        }
+        inputs.push_back(std::move(input));
+    }
+
+    int width = inputs[0]->width();
+    int height = inputs[0]->height();
+    std::unique_ptr<ImageWriter> writer = createImageWriter(outputPath, width, height, halfFloat, compression, 0, true);
+    if (!writer) return -1;
+
+    std::vector<float> band((size_t)BAND_ROWS * width * 4);
+    std::vector<double> sum((size_t)BAND_ROWS * width * 4);
+    std::vector<float> merged((size_t)BAND_ROWS * width * 4);
+    double minSamples = -1.0;
+    double maxSamples = 0.0;
+    for (int top = 0; top < height; top += BAND_ROWS) {
+        int rowCount = std::min(BAND_ROWS, height - top);
+        size_t pixelCount = (size_t)rowCount * width;
+        std::fill(sum.begin(), sum.end(), 0.0);
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            if (!inputs[i]->readRows(top, rowCount, band.data())) return -1;
+            for (size_t p = 0; p < pixelCount; ++p) {
+                double samples = band[p * 4 + 3];
+                for (int c = 0; c < 3; ++c) sum[p * 4 + c] += band[p * 4 + c] * samples;
+                sum[p * 4 + 3] += samples;
+            }
+        }
+        for (size_t p = 0; p < pixelCount; ++p) {
+            double samples = sum[p * 4 + 3];
+            for (int c = 0; c < 3; ++c) merged[p * 4 + c] = samples > 0.0 ? (float)(sum[p * 4 + c] / samples) : 0.0f;
+            merged[p * 4 + 3] = (float)samples;
+            minSamples = (minSamples < 0.0) ? samples : std::min(minSamples, samples);
+            maxSamples = std::max(maxSamples, samples);
+        }
+        if (!writer->writeRows(merged.data(), rowCount)) return -1;
+    }
+    if (!writer->finish()) {
+        std::cerr << "Failed to write " << outputPath << "\n";
+        return -1;
+    }
+
+    std::cout << "Merged " << inputs.size() << " renders\n"
+              << "Samples per pixel: " << minSamples;
+    if (maxSamples != minSamples) std::cout << " to " << maxSamples;
+    std::cout << "\nOutput: " << outputPath << "\n";
+    return 0;
+}
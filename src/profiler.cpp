@@ -0,0 +1,161 @@
+#include "profiler.h"
+#include <glad/glad.h>
+#include <iomanip>
+#include <iostream>
+
+static const char* STAGE_NAMES[STAGE_COUNT] = {"upload", "accumulation", "output"};
+
+static bool endsWith(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+FrameProfiler::FrameProfiler(const std::string& logPath)
+    : m_logPath(logPath), m_json(endsWith(logPath, ".json") || endsWith(logPath, ".jsonl")),
+      m_frameIndex(0), m_openStage(-1), m_stageStart(0.0) {
+    for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+        m_records[i].pending = false;
+        for (int stage = 0; stage < STAGE_COUNT; ++stage) m_records[i].queries[stage] = 0;
+    }
+}
+
+FrameProfiler::~FrameProfiler() {
+    // Flush the frames still in flight in order. Waiting is fine here, the loop is over.
+    for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+        FrameRecord& record = m_records[(m_frameIndex + i) % FRAMES_IN_FLIGHT];
+        if (record.pending) finishRecord(record, true);
+    }
+    for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+        if (m_records[i].queries[0]) glDeleteQueries(STAGE_COUNT, m_records[i].queries);
+    }
+}
+
+bool FrameProfiler::init() {
+    if (!enabled()) return true;
+
+    m_log.open(m_logPath.c_str());
+    if (!m_log) {
+        std::cerr << "Failed to open profile log " << m_logPath << std::endl;
+        return false;
+    }
+    m_log << std::fixed << std::setprecision(4);
+    writeHeader();
+
+    for (int i = 0; i < FRAMES_IN_FLIGHT; ++i) glGenQueries(STAGE_COUNT, m_records[i].queries);
+    m_start = std::chrono::steady_clock::now();
+    return true;
+}
+
+double FrameProfiler::millisecondsSinceStart() const {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+}
+
+void FrameProfiler::writeHeader() {
+    if (m_json) return;
+    m_log << "frame,cpu_start_ms,cpu_frame_ms,passes";
+    for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+        m_log << "," << STAGE_NAMES[stage] << "_cpu_ms," << STAGE_NAMES[stage] << "_gpu_ms";
+    }
+    m_log << ",tile_hits,tile_misses,tile_bypassed,tile_evictions\n";
+}
+
+void FrameProfiler::beginFrame() {
+    if (!enabled()) return;
+    FrameRecord& record = m_records[m_frameIndex % FRAMES_IN_FLIGHT];
+    if (record.pending) finishRecord(record, false);
+
+    record.pending = true;
+    record.frameIndex = m_frameIndex;
+    record.cpuStart = millisecondsSinceStart();
+    record.cpuFrame = 0.0;
+    record.passes = 0;
+    record.tileHits = 0;
+    record.tileMisses = 0;
+    record.tileBypassed = 0;
+    record.tileEvictions = 0;
+    for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+        record.cpuStage[stage] = -1.0;
+        record.stageIssued[stage] = false;
+    }
+}
+
+void FrameProfiler::endFrame() {
+    if (!enabled()) return;
+    if (m_openStage >= 0) endStage();
+    FrameRecord& record = m_records[m_frameIndex % FRAMES_IN_FLIGHT];
+    record.cpuFrame = millisecondsSinceStart() - record.cpuStart;
+    m_frameIndex++;
+}
+
+void FrameProfiler::beginStage(ProfileStage stage) {
+    if (!enabled()) return;
+    if (m_openStage >= 0) endStage();
+    FrameRecord& record = m_records[m_frameIndex % FRAMES_IN_FLIGHT];
+    glBeginQuery(GL_TIME_ELAPSED, record.queries[stage]);
+    record.stageIssued[stage] = true;
+    m_openStage = stage;
+    m_stageStart = millisecondsSinceStart();
+}
+
+void FrameProfiler::endStage() {
+    if (!enabled() || m_openStage < 0) return;
+    glEndQuery(GL_TIME_ELAPSED);
+    FrameRecord& record = m_records[m_frameIndex % FRAMES_IN_FLIGHT];
+    record.cpuStage[m_openStage] = millisecondsSinceStart() - m_stageStart;
+    m_openStage = -1;
+}
+
+void FrameProfiler::setPasses(int passes) {
+    if (!enabled()) return;
+    m_records[m_frameIndex % FRAMES_IN_FLIGHT].passes = passes;
+}
+
+void FrameProfiler::setTileStats(long long hits, long long misses, long long bypassed, long long evictions) {
+    if (!enabled()) return;
+    FrameRecord& record = m_records[m_frameIndex % FRAMES_IN_FLIGHT];
+    record.tileHits = hits;
+    record.tileMisses = misses;
+    record.tileBypassed = bypassed;
+    record.tileEvictions = evictions;
+}
+
+void FrameProfiler::finishRecord(FrameRecord& record, bool wait) {
+    double gpuStage[STAGE_COUNT];
+    for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+        gpuStage[stage] = -1.0;
+        if (!record.stageIssued[stage]) continue;
+
+        int available = 1;
+        if (!wait) glGetQueryObjectiv(record.queries[stage], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) continue;
+
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(record.queries[stage], GL_QUERY_RESULT, &nanoseconds);
+        gpuStage[stage] = nanoseconds / 1.0e6;
+    }
+
+    // Stages that didn't run, and GPU results that weren't ready in time, are left empty (null in JSON)
+    if (m_json) {
+        m_log << "{\"frame\":" << record.frameIndex << ",\"cpu_start_ms\":" << record.cpuStart
+              << ",\"cpu_frame_ms\":" << record.cpuFrame << ",\"passes\":" << record.passes;
+        for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+            m_log << ",\"" << STAGE_NAMES[stage] << "_cpu_ms\":";
+            if (record.cpuStage[stage] >= 0.0) m_log << record.cpuStage[stage];
+            else m_log << "null";
+            m_log << ",\"" << STAGE_NAMES[stage] << "_gpu_ms\":";
+            if (gpuStage[stage] >= 0.0) m_log << gpuStage[stage];
+            else m_log << "null";
+        }
+        m_log << ",\"tile_hits\":" << record.tileHits << ",\"tile_misses\":" << record.tileMisses
+              << ",\"tile_bypassed\":" << record.tileBypassed << ",\"tile_evictions\":" << record.tileEvictions << "}\n";
+    } else {
+        m_log << record.frameIndex << "," << record.cpuStart << "," << record.cpuFrame << "," << record.passes;
+        for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+            m_log << ",";
+            if (record.cpuStage[stage] >= 0.0) m_log << record.cpuStage[stage];
+            m_log << ",";
+            if (gpuStage[stage] >= 0.0) m_log << gpuStage[stage];
+        }
+        m_log << "," << record.tileHits << "," << record.tileMisses << "," << record.tileBypassed << "," << record.tileEvictions << "\n";
+    }
+    record.pending = false;
+}
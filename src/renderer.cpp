@@ -0,0 +1,771 @@
+#include "renderer.h"
+#include "skycube.h"
+#include "skysampler.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+
+static const int TILE_SIZE = 8; // Must match local_size_x/y in shaders/compute.glsl
+static const int DEFAULT_PERSISTENT_WORKGROUPS = 256;
+// Reprojected history counts as at most this many passes: it is resampled and its view-dependent
+// shading is stale, so new passes have to be able to replace it within a second or so
+static const int MAX_HISTORY_PASSES = 32;
+// The sky sampler averages blocks of sky texels down to at most this width
+static const int MAX_SKY_SAMPLER_WIDTH = 512;
+// Cube faces a quarter of the sky image wide keep its resolution around the horizon
+static const int MAX_SKY_CUBE_SIZE = 1024;
+// The prefiltered sky starts at this face size and halves it per level, from mirror to fully rough
+static const int SKY_PREFILTER_SIZE = 32;
+static const int SKY_PREFILTER_LEVELS = 6; // Must match shaders/pathtracer.glsl
+static const unsigned char FLAT_SKY[3] = {140, 180, 230};
+
+enum UniformBlockBinding {
+    CAMERA_BLOCK = 0,
+    SETTINGS_BLOCK = 1,
+    SCENE_BLOCK = 2
+};
+
+// std140 mirrors of the uniform blocks in shaders/pathtracer.glsl. vec3 members are 16-byte aligned,
+// structs and arrays of structs round up to 16 bytes.
+struct GpuMaterial {
+    float albedo[3];
+    float padding0;
+    float specular[3];
+    float padding1;
+    float emission[3];
+    float emissionStrength;
+    float roughness;
+    float specularHighlight;
+    float specularExponent;
+    float padding2;
+};
+
+struct GpuObject {
+    unsigned int type;
+    float padding0[3];
+    float position[3];
+    float padding1;
+    float scale[3];
+    float padding2;
+    GpuMaterial material;
+};
+
+struct GpuPointLight {
+    float position[3];
+    float radius;
+    float color[3];
+    float power;
+    float reach;
+    float padding[3];
+};
+
+struct GpuCameraBlock {
+    float rotationMatrix[16];
+    float cameraPosition[3];
+    float aspectRatio;
+};
+
+struct GpuSettingsBlock {
+    int shadowResolution;
+    int lightBounces;
+    int framePasses;
+    float blur;
+    float bloomRadius;
+    float bloomIntensity;
+    int skyCacheDepth;
+    float padding;
+    float skyDiffuse[SKY_DIFFUSE_COEFFICIENTS][4]; // vec4s, std140 pads vec3 arrays to them anyway
+};
+
+struct GpuSceneBlock {
+    GpuObject objects[MAX_OBJECT_COUNT];
+    GpuPointLight lights[MAX_LIGHT_COUNT];
+    GpuMaterial planeMaterial;
+    int planeVisible;
+    int objectCount;
+    int lightCount;
+};
+
+static_assert(sizeof(GpuMaterial) == 64, "GpuMaterial must match the std140 Material layout");
+static_assert(sizeof(GpuObject) == 112, "GpuObject must match the std140 Object layout");
+static_assert(sizeof(GpuPointLight) == 48, "GpuPointLight must match the std140 PointLight layout");
+static_assert(sizeof(GpuCameraBlock) == 80, "GpuCameraBlock must match CameraBlock");
+static_assert(sizeof(GpuSettingsBlock) == 288, "GpuSettingsBlock must match SettingsBlock");
+
+static void copyVec3(float out[3], const Vec3& value) {
+    out[0] = value.x;
+    out[1] = value.y;
+    out[2] = value.z;
+}
+
+static GpuMaterial toGpuMaterial(const Material& material) {
+    GpuMaterial gpu = GpuMaterial();
+    copyVec3(gpu.albedo, material.albedo);
+    copyVec3(gpu.specular, material.specular);
+    copyVec3(gpu.emission, material.emission);
+    gpu.emissionStrength = material.emissionStrength;
+    gpu.roughness = material.roughness;
+    gpu.specularHighlight = material.specularHighlight;
+    gpu.specularExponent = material.specularExponent;
+    return gpu;
+}
+
+// Render target with nearest sampling, so texels of the previous pass are read back exactly
+static void createTargetTexture(unsigned int texture, GLenum format, int width, int height) {
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+Renderer::Renderer(int width, int height, RenderBackend backend, AccumulationMode accumulation)
+    : m_width(width), m_height(height), m_imageWidth(width), m_imageHeight(height), m_regionX(0), m_regionY(0),
+      m_backend(backend), m_accumulation(accumulation),
+      m_scene(createDefaultScene()), m_camera(createDefaultCamera()),
+      m_selectedObject(-1), m_sampleSeed(0), m_accumulatedPasses(0),
+      m_featureBuffers(false), m_featurePasses(0), m_persistentWorkgroups(DEFAULT_PERSISTENT_WORKGROUPS),
+      m_passRow(0), m_reprojection(false), m_checkerboard(false), m_reprojectPending(false),
+      m_quadVAO(0), m_quadVBO(0), m_quadEBO(0), m_readFramebuffer(0), m_snapshotTexture(0), m_readIndex(0), m_tileCounterBuffer(0), m_presentSampler(0), m_skyboxTexture(0),
+      m_textureLoader(NULL), m_streamTextures(false), m_reportTextureErrors(true), m_skySamplerTexture(0), m_skyPrefilteredTexture(0),
+      m_cameraDirty(true), m_settingsDirty(true), m_sceneDirty(true) {
+    m_accumulationTextures[0] = m_accumulationTextures[1] = 0;
+    for (int i = 0; i < 2; ++i) {
+        for (int f = 0; f < FEATURE_COUNT; ++f) m_featureTextures[i][f] = 0;
+    }
+    m_framebuffers[0] = m_framebuffers[1] = 0;
+    m_historyTextures[0] = m_historyTextures[1] = 0;
+    m_uniformBuffers[0] = m_uniformBuffers[1] = m_uniformBuffers[2] = 0;
+}
+
+Renderer::~Renderer() {
+    glDeleteVertexArrays(1, &m_quadVAO);
+    glDeleteBuffers(1, &m_quadVBO);
+    glDeleteBuffers(1, &m_quadEBO);
+    glDeleteTextures(2, m_accumulationTextures);
+    glDeleteTextures(2 * FEATURE_COUNT, &m_featureTextures[0][0]);
+    glDeleteFramebuffers(2, m_framebuffers);
+    glDeleteFramebuffers(1, &m_readFramebuffer);
+    glDeleteTextures(1, &m_snapshotTexture);
+    glDeleteTextures(2, m_historyTextures);
+    glDeleteBuffers(1, &m_tileCounterBuffer);
+    glDeleteSamplers(1, &m_presentSampler);
+    glDeleteTextures(1, &m_skyboxTexture);
+    glDeleteTextures(1, &m_skySamplerTexture);
+    glDeleteTextures(1, &m_skyPrefilteredTexture);
+    glDeleteBuffers(3, m_uniformBuffers);
+}
+
+bool Renderer::init() {
+    if (m_checkerboard && m_backend != BACKEND_COMPUTE) {
+        std::cerr << "Checkerboard rendering needs the compute backend\n";
+        return false;
+    }
+
+    m_displayShader.reset(new Shader(
+        std::vector<std::string>{"shaders/vertex.glsl"},
+        std::vector<std::string>{"shaders/pathtracer.glsl", "shaders/fragment.glsl"}));
+    if (!m_displayShader->valid()) return false;
+
+    if (m_backend == BACKEND_COMPUTE) {
+        // The image format qualifier has to match the texture format
+        std::string defines = (m_accumulation == ACCUMULATE_AVERAGE_HALF) ? "#define HALF_ACCUMULATION\n" : "";
+        m_computeShader.reset(new Shader(std::vector<std::string>{"shaders/pathtracer.glsl", "shaders/compute.glsl"}, defines));
+        if (!m_computeShader->valid()) return false;
+    }
+
+    // Full-screen quad
+    float vertices[] = {
+        // positions        // texture coords
+        -1.0f,  1.0f, 0.0f,  0.0f, 1.0f,
+        -1.0f, -1.0f, 0.0f,  0.0f, 0.0f,
+         1.0f, -1.0f, 0.0f,  1.0f, 0.0f,
+         1.0f,  1.0f, 0.0f,  1.0f, 1.0f
+    };
+    unsigned int indices[] = {
+        0, 1, 2,
+        0, 2, 3
+    };
+
+    glGenVertexArrays(1, &m_quadVAO);
+    glGenBuffers(1, &m_quadVBO);
+    glGenBuffers(1, &m_quadEBO);
+    glBindVertexArray(m_quadVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, m_quadVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_quadEBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+
+    // Reprojection finds disocclusions through the normal-depth buffer
+    if (m_reprojection) m_featureBuffers = true;
+
+    // Accumulation targets. The compute backend accumulates in place, so it only needs the first one.
+    int targetCount = (m_backend == BACKEND_FRAGMENT) ? 2 : 1;
+    glGenTextures(targetCount, m_accumulationTextures);
+    for (int i = 0; i < targetCount; ++i) {
+        createTargetTexture(m_accumulationTextures[i], accumulationFormat(), m_width, m_height);
+        // Features are always float, depth needs the precision
+        if (m_featureBuffers) {
+            glGenTextures(FEATURE_COUNT, m_featureTextures[i]);
+            for (int f = 0; f < FEATURE_COUNT; ++f) createTargetTexture(m_featureTextures[i][f], GL_RGBA32F, m_width, m_height);
+        }
+    }
+
+    if (m_backend == BACKEND_FRAGMENT) {
+        glGenFramebuffers(2, m_framebuffers);
+        for (int i = 0; i < 2; ++i) {
+            glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffers[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_accumulationTextures[i], 0);
+            if (m_featureBuffers) {
+                GLenum drawBuffers[1 + FEATURE_COUNT] = {GL_COLOR_ATTACHMENT0};
+                for (int f = 0; f < FEATURE_COUNT; ++f) {
+                    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1 + f, GL_TEXTURE_2D, m_featureTextures[i][f], 0);
+                    drawBuffers[1 + f] = GL_COLOR_ATTACHMENT1 + f;
+                }
+                glDrawBuffers(1 + FEATURE_COUNT, drawBuffers);
+            }
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+                std::cerr << "Accumulation framebuffer is incomplete" << std::endl;
+                return false;
+            }
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    } else {
+        // llvmpipe caps the loop iterations of a single invocation, which cuts long-running persistent
+        // workgroups short. It already schedules workgroups over its own thread pool, so plain tiles lose nothing.
+        const char* rendererName = (const char*)glGetString(GL_RENDERER);
+        if (rendererName && std::string(rendererName).find("llvmpipe") != std::string::npos) {
+            m_persistentWorkgroups = 0;
+        }
+
+        // Reprojecting reads the previous accumulation around other pixels, which would be
+        // overwritten in place, so it reads copies instead
+        if (m_reprojection) {
+            glGenTextures(2, m_historyTextures);
+            createTargetTexture(m_historyTextures[0], accumulationFormat(), m_width, m_height);
+            createTargetTexture(m_historyTextures[1], GL_RGBA32F, m_width, m_height);
+        }
+
+        glGenBuffers(1, &m_tileCounterBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_tileCounterBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(unsigned int), NULL, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_tileCounterBuffer);
+    }
+
+    glGenSamplers(1, &m_presentSampler);
+    glSamplerParameteri(m_presentSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glSamplerParameteri(m_presentSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glSamplerParameteri(m_presentSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(m_presentSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glGenBuffers(3, m_uniformBuffers);
+    const size_t blockSizes[3] = {sizeof(GpuCameraBlock), sizeof(GpuSettingsBlock), sizeof(GpuSceneBlock)};
+    for (int i = 0; i < 3; ++i) {
+        glBindBuffer(GL_UNIFORM_BUFFER, m_uniformBuffers[i]);
+        glBufferData(GL_UNIFORM_BUFFER, blockSizes[i], NULL, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, i, m_uniformBuffers[i]);
+    }
+    m_cameraDirty = m_settingsDirty = m_sceneDirty = true;
+
+    // Sampler units never change
+    m_displayShader->use();
+    m_displayShader->setInt("u_screenTexture", 0);
+    m_displayShader->setInt("u_skyboxTexture", 1);
+    m_displayShader->setInt("u_skySamplerTable", 4);
+    m_displayShader->setInt("u_skyPrefiltered", 5);
+    m_displayShader->setBool("u_debugKeyPressed", false);
+    m_displayShader->setBool("u_runningAverage", m_accumulation != ACCUMULATE_SUM);
+    m_displayShader->setInt("u_albedoTexture", 2);
+    m_displayShader->setInt("u_normalDepthTexture", 3);
+    m_displayShader->setBool("u_featureBuffers", m_featureBuffers);
+    m_displayShader->setInt("u_maxHistoryPasses", MAX_HISTORY_PASSES);
+    if (m_computeShader) {
+        m_computeShader->use();
+        m_computeShader->setInt("u_screenTexture", 0);
+        m_computeShader->setInt("u_normalDepthTexture", 3);
+        m_computeShader->setInt("u_maxHistoryPasses", MAX_HISTORY_PASSES);
+        m_computeShader->setInt("u_skyboxTexture", 1);
+        m_computeShader->setInt("u_skySamplerTable", 4);
+        m_computeShader->setInt("u_skyPrefiltered", 5);
+        m_computeShader->setBool("u_debugKeyPressed", false);
+        m_computeShader->setBool("u_runningAverage", m_accumulation != ACCUMULATE_SUM);
+        m_computeShader->setBool("u_featureBuffers", m_featureBuffers);
+    }
+
+    // Cube faces filter across their edges like one texture
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+    if (!m_textureLoader) {
+        m_ownTextureLoader.reset(new TextureLoader(1));
+        m_textureLoader = m_ownTextureLoader.get();
+    }
+    // The flat sky stands in until the first pass installs the skybox
+    m_pendingSkybox = loadSkybox(*m_textureLoader, m_scene.skyboxPath);
+    updateSky();
+    return true;
+}
+
+void Renderer::setScene(const Scene& scene) {
+    bool skyboxChanged = scene.skyboxPath != m_scene.skyboxPath;
+    bool skyChanged = scene.settings.skyboxStrength != m_scene.settings.skyboxStrength ||
+                      scene.settings.skyboxGamma != m_scene.settings.skyboxGamma ||
+                      scene.settings.skyboxCeiling != m_scene.settings.skyboxCeiling;
+    m_scene = scene;
+    m_settingsDirty = true;
+    m_sceneDirty = true;
+    // Before init() there's nothing to update, init() loads the sky itself. A new skybox brings its
+    // settings along when it's installed.
+    if (m_textureLoader) {
+        if (skyboxChanged) m_pendingSkybox = loadSkybox(*m_textureLoader, m_scene.skyboxPath);
+        else if (skyChanged) updateSky();
+    }
+    resetAccumulation();
+}
+
+// Puts the skybox of the current scene in once it's decoded, or right away when not streaming. Only
+// between passes, so a pass never mixes two skies.
+void Renderer::installPendingSkybox() {
+    if (!m_pendingSkybox || m_passRow > 0) return;
+    if (m_streamTextures && !m_pendingSkybox->ready()) return;
+    if (m_pendingSkybox->wait()) {
+        m_skybox = m_pendingSkybox;
+    } else {
+        if (m_reportTextureErrors) {
+            std::cerr << "Failed to load texture " << m_pendingSkybox->path() << " (" << m_pendingSkybox->error() << "), using a flat sky"
+                      << std::endl;
+        }
+        m_skybox.reset();
+    }
+    m_pendingSkybox.reset();
+    updateSky();
+    // Passes so far saw the sky it replaces
+    if (m_streamTextures) resetAccumulation();
+}
+
+// Bakes the sky's radiance (strength, gamma and ceiling applied) into the cube map sampleSkybox() reads,
+// along with its averages for the sky cache, and rebuilds the sky sampler from the same radiance,
+// averaged over blocks of texels for big skies. The flat fallback sky gains nothing from a sampler,
+// bounces find it just as well.
+void Renderer::updateSky() {
+    const RenderSettings& settings = m_scene.settings;
+    float levels[256];
+    for (int i = 0; i < 256; ++i) {
+        levels[i] = std::min(settings.skyboxCeiling, settings.skyboxStrength * std::pow(i / 255.0f, 1.0f / settings.skyboxGamma));
+    }
+    bool flat = !m_skybox;
+    const TextureLevel* image = flat ? NULL : &m_skybox->image().levels[0];
+    int skyWidth = flat ? 1 : image->width;
+    int skyHeight = flat ? 1 : image->height;
+    std::vector<float> sky((size_t)skyWidth * skyHeight * 3);
+    if (flat || !m_skybox->image().hdr) {
+        const unsigned char* pixels = flat ? FLAT_SKY : image->bytes();
+        for (size_t i = 0; i < sky.size(); ++i) sky[i] = levels[pixels[i]];
+    } else {
+        // HDR skies are linear radiance already, gamma 1 keeps them that way
+        for (size_t i = 0; i < sky.size(); ++i) {
+            sky[i] = std::min(settings.skyboxCeiling, settings.skyboxStrength * std::pow(image->floats()[i], 1.0f / settings.skyboxGamma));
+        }
+    }
+
+    int faceSize = std::max(1, std::min(skyWidth / 4, MAX_SKY_CUBE_SIZE));
+    std::vector<float> faces;
+    bakeSkyCube(sky.data(), skyWidth, skyHeight, faceSize, faces);
+    glDeleteTextures(1, &m_skyboxTexture);
+    glGenTextures(1, &m_skyboxTexture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, m_skyboxTexture);
+    for (int face = 0; face < 6; ++face) {
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGB16F, faceSize, faceSize, 0, GL_RGB, GL_FLOAT,
+                     &faces[(size_t)face * faceSize * faceSize * 3]);
+    }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+    // The averages only need a coarse sky, which also keeps the convolutions cheap
+    std::vector<float> coarse;
+    if (faceSize >= SKY_PREFILTER_SIZE) downsampleSkyCube(faces, faceSize, SKY_PREFILTER_SIZE, coarse);
+    else bakeSkyCube(sky.data(), skyWidth, skyHeight, SKY_PREFILTER_SIZE, coarse);
+    projectSkyDiffuse(coarse, SKY_PREFILTER_SIZE, m_skyDiffuse);
+    std::vector<std::vector<float> > mips;
+    prefilterSkyCube(coarse, SKY_PREFILTER_SIZE, SKY_PREFILTER_LEVELS, mips);
+    glDeleteTextures(1, &m_skyPrefilteredTexture);
+    glGenTextures(1, &m_skyPrefilteredTexture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, m_skyPrefilteredTexture);
+    glTexStorage2D(GL_TEXTURE_CUBE_MAP, SKY_PREFILTER_LEVELS, GL_RGB16F, SKY_PREFILTER_SIZE, SKY_PREFILTER_SIZE);
+    for (int level = 0; level < SKY_PREFILTER_LEVELS; ++level) {
+        int size = SKY_PREFILTER_SIZE >> level;
+        for (int face = 0; face < 6; ++face) {
+            glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, 0, 0, size, size, GL_RGB, GL_FLOAT,
+                            &mips[level][(size_t)face * size * size * 3]);
+        }
+    }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    m_settingsDirty = true;
+
+    glDeleteTextures(1, &m_skySamplerTexture);
+    m_skySamplerTexture = 0;
+    if (flat || settings.skyboxStrength == 0.0f) return;
+
+    int factor = (skyWidth + MAX_SKY_SAMPLER_WIDTH - 1) / MAX_SKY_SAMPLER_WIDTH;
+    int width = (skyWidth + factor - 1) / factor;
+    int height = (skyHeight + factor - 1) / factor;
+    std::vector<float> radiance((size_t)width * height * 3, 0.0f);
+    std::vector<int> counts((size_t)width * height, 0);
+    for (int y = 0; y < skyHeight; ++y) {
+        for (int x = 0; x < skyWidth; ++x) {
+            size_t block = (size_t)(y / factor) * width + x / factor;
+            const float* rgb = &sky[((size_t)y * skyWidth + x) * 3];
+            for (int c = 0; c < 3; ++c) radiance[block * 3 + c] += rgb[c];
+            counts[block]++;
+        }
+    }
+    for (size_t i = 0; i < counts.size(); ++i) {
+        for (int c = 0; c < 3; ++c) radiance[i * 3 + c] /= counts[i];
+    }
+
+    SkySampler sampler;
+    if (!buildSkySampler(radiance.data(), width, height, sampler)) return;
+    glGenTextures(1, &m_skySamplerTexture);
+    createTargetTexture(m_skySamplerTexture, GL_RGBA32F, width, height);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, sampler.table.data());
+}
+
+void Renderer::setCamera(const Camera& camera) {
+    // Rows of an unfinished pass already went into the compute backend's target in place, which would
+    // then hold two views
+    bool mixedViews = m_backend == BACKEND_COMPUTE && m_passRow > 0;
+    if (m_reprojection && m_accumulatedPasses > 0 && !mixedViews) {
+        // Several moves between two passes reproject from the camera the accumulation was rendered with
+        if (!m_reprojectPending) m_previousCamera = m_camera;
+        m_reprojectPending = true;
+        // The reprojecting pass writes fresh features, the next reprojection compares against them
+        m_featurePasses = 0;
+        m_passRow = 0;
+    } else {
+        resetAccumulation();
+    }
+    m_camera = camera;
+    m_cameraDirty = true;
+}
+
+void Renderer::setImageRegion(int imageWidth, int imageHeight, int x, int y) {
+    if (imageWidth != m_imageWidth || imageHeight != m_imageHeight) m_cameraDirty = true; // Aspect ratio
+    m_imageWidth = imageWidth;
+    m_imageHeight = imageHeight;
+    m_regionX = x;
+    m_regionY = y;
+    resetAccumulation();
+}
+
+void Renderer::uploadDirtyBlocks() {
+    // Binding points are context state, another renderer on the same context may have taken them
+    for (int i = 0; i < 3; ++i) glBindBufferBase(GL_UNIFORM_BUFFER, i, m_uniformBuffers[i]);
+
+    if (m_cameraDirty) {
+        GpuCameraBlock block;
+        m_camera.getRotationMatrix(block.rotationMatrix);
+        copyVec3(block.cameraPosition, m_camera.position);
+        block.aspectRatio = (float)m_imageWidth / (float)m_imageHeight;
+        glBindBuffer(GL_UNIFORM_BUFFER, m_uniformBuffers[CAMERA_BLOCK]);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &block);
+        m_cameraDirty = false;
+    }
+
+    if (m_settingsDirty) {
+        const RenderSettings& settings = m_scene.settings;
+        GpuSettingsBlock block;
+        block.shadowResolution = settings.shadowResolution;
+        block.lightBounces = settings.lightBounces;
+        block.framePasses = settings.framePasses;
+        block.blur = settings.blur;
+        block.bloomRadius = settings.bloomRadius;
+        block.bloomIntensity = settings.bloomIntensity;
+        block.skyCacheDepth = settings.skyCacheDepth;
+        block.padding = 0.0f;
+        for (int i = 0; i < SKY_DIFFUSE_COEFFICIENTS; ++i) {
+            for (int c = 0; c < 3; ++c) block.skyDiffuse[i][c] = m_skyDiffuse[i][c];
+            block.skyDiffuse[i][3] = 0.0f;
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, m_uniformBuffers[SETTINGS_BLOCK]);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &block);
+        m_settingsDirty = false;
+    }
+
+    if (m_sceneDirty) {
+        // ~7 KB, so it's built on the heap and only when the scene was actually edited
+        std::unique_ptr<GpuSceneBlock> block(new GpuSceneBlock());
+        int objectCount = std::min((int)m_scene.objects.size(), MAX_OBJECT_COUNT);
+        for (int i = 0; i < objectCount; ++i) {
+            const Object& object = m_scene.objects[i];
+            block->objects[i].type = object.type;
+            copyVec3(block->objects[i].position, object.position);
+            copyVec3(block->objects[i].scale, object.scale);
+            block->objects[i].material = toGpuMaterial(object.material);
+        }
+        int lightCount = std::min((int)m_scene.lights.size(), MAX_LIGHT_COUNT);
+        for (int i = 0; i < lightCount; ++i) {
+            const PointLight& light = m_scene.lights[i];
+            copyVec3(block->lights[i].position, light.position);
+            block->lights[i].radius = light.radius;
+            copyVec3(block->lights[i].color, light.color);
+            block->lights[i].power = light.power;
+            block->lights[i].reach = light.reach;
+        }
+        block->planeMaterial = toGpuMaterial(m_scene.planeMaterial);
+        block->planeVisible = m_scene.planeVisible ? 1 : 0;
+        block->objectCount = objectCount;
+        block->lightCount = lightCount;
+        glBindBuffer(GL_UNIFORM_BUFFER, m_uniformBuffers[SCENE_BLOCK]);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(GpuSceneBlock), block.get());
+        m_sceneDirty = false;
+    }
+}
+
+// The few uniforms that change every pass stay plain uniforms, with cached locations
+void Renderer::setPassUniforms(const Shader& shader) const {
+    shader.setInt("u_accumulatedPasses", m_accumulatedPasses);
+    shader.setInt("u_featurePasses", m_featurePasses);
+    shader.setFloat("u_time", (float)(m_accumulatedPasses * m_scene.settings.framePasses));
+    shader.setInt("u_sampleSeed", m_sampleSeed);
+    shader.setInt("u_selectedSphereIndex", m_selectedObject);
+    shader.setVec2i("u_regionOffset", m_regionX, m_regionY);
+    shader.setVec2i("u_imageSize", m_imageWidth, m_imageHeight);
+    shader.setBool("u_reprojectHistory", m_reprojectPending);
+    shader.setBool("u_skySampling", m_skySamplerTexture != 0);
+    // The parity restarts with the feature buffers, so every pixel's feature pass count follows from theirs
+    shader.setInt("u_checkerboardParity", m_checkerboard ? (m_featurePasses & 1) : -1);
+    if (m_reprojectPending) {
+        float rotation[16];
+        float position[3];
+        m_previousCamera.getRotationMatrix(rotation);
+        copyVec3(position, m_previousCamera.position);
+        shader.setMat4("u_previousRotationMatrix", rotation);
+        shader.setVec3("u_previousCameraPosition", position);
+    }
+}
+
+void Renderer::renderPass() {
+    renderPassRows(m_height);
+}
+
+bool Renderer::renderPassRows(int rowCount) {
+    installPendingSkybox();
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, m_skyboxTexture);
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D, m_skySamplerTexture);
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, m_skyPrefilteredTexture);
+    uploadDirtyBlocks();
+
+    // Every part of a pass gets the same uniforms, so it traces the same samples as a whole pass would
+    int rowBegin = m_passRow;
+    int rowEnd = std::min(rowBegin + std::max(rowCount, 1), m_height);
+    if (m_backend == BACKEND_COMPUTE) {
+        rowEnd = std::min((rowEnd + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE, m_height);
+        renderComputePass(rowBegin, rowEnd);
+    } else {
+        renderFragmentPass(rowBegin, rowEnd);
+    }
+    if (rowEnd < m_height) {
+        m_passRow = rowEnd;
+        return false;
+    }
+
+    m_passRow = 0;
+    m_accumulatedPasses++;
+    m_featurePasses++;
+    m_reprojectPending = false;
+    return true;
+}
+
+void Renderer::renderFragmentPass(int rowBegin, int rowEnd) {
+    int writeIndex = 1 - m_readIndex;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffers[writeIndex]);
+    glViewport(0, 0, m_width, m_height);
+    // Parts of a pass all read the previous target and fill their rows of the other one
+    bool partial = rowBegin > 0 || rowEnd < m_height;
+    if (partial) {
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(0, rowBegin, m_width, rowEnd - rowBegin);
+    }
+
+    m_displayShader->use();
+    setPassUniforms(*m_displayShader);
+    m_displayShader->setBool("u_directOutputPass", false);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_accumulationTextures[m_readIndex]);
+    if (m_featureBuffers) {
+        for (int f = 0; f < FEATURE_COUNT; ++f) {
+            glActiveTexture(GL_TEXTURE2 + f);
+            glBindTexture(GL_TEXTURE_2D, m_featureTextures[m_readIndex][f]);
+        }
+    }
+    glBindVertexArray(m_quadVAO);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+
+    if (partial) glDisable(GL_SCISSOR_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (rowEnd == m_height) m_readIndex = writeIndex;
+}
+
+// rowBegin is a multiple of TILE_SIZE, rowEnd too unless it is the height
+void Renderer::renderComputePass(int rowBegin, int rowEnd) {
+    // Checkerboard tiles cover twice the columns, see compute.glsl
+    int tileWidth = m_checkerboard ? 2 * TILE_SIZE : TILE_SIZE;
+    int tilesX = (m_width + tileWidth - 1) / tileWidth;
+    int tilesY = (rowEnd - rowBegin + TILE_SIZE - 1) / TILE_SIZE;
+    int tileCount = tilesX * tilesY;
+
+    m_computeShader->use();
+    setPassUniforms(*m_computeShader);
+    m_computeShader->setVec2i("u_tileCount", tilesX, tilesY);
+    m_computeShader->setInt("u_firstTileRow", rowBegin / TILE_SIZE);
+    if (m_reprojectPending) {
+        // The whole history is copied before the first part of the pass overwrites any of it
+        if (rowBegin == 0) {
+            glMemoryBarrier(GL_ALL_BARRIER_BITS);
+            glCopyImageSubData(m_accumulationTextures[0], GL_TEXTURE_2D, 0, 0, 0, 0,
+                               m_historyTextures[0], GL_TEXTURE_2D, 0, 0, 0, 0, m_width, m_height, 1);
+            glCopyImageSubData(m_featureTextures[0][FEATURE_NORMAL_DEPTH], GL_TEXTURE_2D, 0, 0, 0, 0,
+                               m_historyTextures[1], GL_TEXTURE_2D, 0, 0, 0, 0, m_width, m_height, 1);
+        }
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, m_historyTextures[0]);
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_2D, m_historyTextures[1]);
+    }
+    glBindImageTexture(0, m_accumulationTextures[0], 0, GL_FALSE, 0, GL_READ_WRITE, accumulationFormat());
+    if (m_featureBuffers) {
+        for (int f = 0; f < FEATURE_COUNT; ++f) {
+            glBindImageTexture(1 + f, m_featureTextures[0][f], 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+        }
+    }
+
+    if (m_persistentWorkgroups > 0) {
+        unsigned int zero = 0;
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_tileCounterBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero), &zero);
+        m_computeShader->setBool("u_persistentThreads", true);
+        glDispatchCompute(std::min(m_persistentWorkgroups, tileCount), 1, 1);
+    } else {
+        m_computeShader->setBool("u_persistentThreads", false);
+        glDispatchCompute(tilesX, tilesY, 1);
+    }
+
+    // The next pass reads the image back, present() samples it as a texture, and the tile counter
+    // must not be reset by glBufferSubData while the atomics of this dispatch are still in flight
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+}
+
+GLenum Renderer::accumulationFormat() const {
+    return (m_accumulation == ACCUMULATE_AVERAGE_HALF) ? GL_RGBA16F : GL_RGBA32F;
+}
+
+unsigned int Renderer::outputTexture() const {
+    return (m_backend == BACKEND_COMPUTE) ? m_accumulationTextures[0] : m_accumulationTextures[m_readIndex];
+}
+
+void Renderer::present(int viewportWidth, int viewportHeight) {
+    // While refining, only the finished rows of the pass in progress show the current view. The fragment
+    // backend writes them to the target it swaps to at the end of the pass.
+    bool refiningRows = refining();
+    int rows = refiningRows ? m_passRow : m_height;
+    if (rows == 0) return;
+    unsigned int texture = outputTexture();
+    if (refiningRows && m_backend == BACKEND_FRAGMENT) texture = m_accumulationTextures[1 - m_readIndex];
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, viewportWidth, viewportHeight);
+    if (refiningRows) {
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(0, 0, viewportWidth, (int)((long long)rows * viewportHeight / m_height));
+    }
+
+    uploadDirtyBlocks();
+    m_displayShader->use();
+    setPassUniforms(*m_displayShader);
+    m_displayShader->setBool("u_directOutputPass", true);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    if (m_width < viewportWidth || m_height < viewportHeight) glBindSampler(0, m_presentSampler);
+    glBindVertexArray(m_quadVAO);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+    glBindSampler(0, 0);
+    if (refiningRows) glDisable(GL_SCISSOR_TEST);
+}
+
+void Renderer::readTextureRows(unsigned int texture, int rowBegin, int rowCount, float* out) {
+    if (!m_readFramebuffer) glGenFramebuffers(1, &m_readFramebuffer);
+
+    // The compute backend wrote the texture through image stores
+    if (m_backend == BACKEND_COMPUTE) glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+
+    // Re-attached every time, the fragment backend alternates between its two targets
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_readFramebuffer);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, rowBegin, m_width, rowCount, GL_RGBA, GL_FLOAT, out);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+void Renderer::readRows(int rowBegin, int rowCount, float* out) {
+    readTextureRows(outputTexture(), rowBegin, rowCount, out);
+
+    // Same normalization as the output pass in shaders/fragment.glsl, by the pass count in alpha
+    if (m_accumulation == ACCUMULATE_SUM && m_accumulatedPasses > 0) {
+        size_t pixelCount = (size_t)rowCount * m_width;
+        for (size_t i = 0; i < pixelCount; ++i) {
+            // Pixels skipped by a checkerboard pass can hold none yet
+            if (out[i * 4 + 3] == 0.0f) continue;
+            float scale = 1.0f / out[i * 4 + 3];
+            for (int c = 0; c < 3; ++c) out[i * 4 + c] *= scale;
+        }
+    }
+}
+
+void Renderer::readFeatureRows(FeatureBuffer feature, int rowBegin, int rowCount, float* out) {
+    int index = (m_backend == BACKEND_COMPUTE) ? 0 : m_readIndex;
+    readTextureRows(m_featureTextures[index][feature], rowBegin, rowCount, out);
+}
+
+int Renderer::snapshotAccumulation() {
+    if (!m_snapshotTexture) {
+        glGenTextures(1, &m_snapshotTexture);
+        glBindTexture(GL_TEXTURE_2D, m_snapshotTexture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, accumulationFormat(), m_width, m_height);
+    }
+    // No barrier bit names glCopyImageSubData specifically
+    if (m_backend == BACKEND_COMPUTE) glMemoryBarrier(GL_ALL_BARRIER_BITS);
+    glCopyImageSubData(outputTexture(), GL_TEXTURE_2D, 0, 0, 0, 0,
+                       m_snapshotTexture, GL_TEXTURE_2D, 0, 0, 0, 0, m_width, m_height, 1);
+    return m_accumulatedPasses;
+}
+
+void Renderer::readSnapshotRows(int rowBegin, int rowCount, float* out) {
+    readTextureRows(m_snapshotTexture, rowBegin, rowCount, out);
+}
+
+void Renderer::loadAccumulation(const float* rgba, int passes) {
+    glBindTexture(GL_TEXTURE_2D, outputTexture());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RGBA, GL_FLOAT, rgba);
+    m_accumulatedPasses = passes;
+    m_featurePasses = 0;
+    m_reprojectPending = false;
+}
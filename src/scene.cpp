@@ -0,0 +1,263 @@
+#include "scene.h"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+Material makeMaterial(Vec3 albedo, Vec3 specular, float roughness) {
+    Material material;
+    material.albedo = albedo;
+    material.specular = specular;
+    material.emission = Vec3{0.0f, 0.0f, 0.0f};
+    material.emissionStrength = 0.0f;
+    material.roughness = roughness;
+    material.specularHighlight = 0.0f;
+    material.specularExponent = 1.0f;
+    return material;
+}
+
+Scene createDefaultScene() {
+    Scene scene;
+
+    Object sphere;
+    sphere.type = OBJECT_SPHERE;
+    sphere.position = Vec3{0.0f, 1.0f, 0.0f};
+    sphere.scale = Vec3{1.0f, 1.0f, 1.0f};
+    sphere.material = makeMaterial(Vec3{0.8f, 0.2f, 0.2f}, Vec3{0.1f, 0.1f, 0.1f}, 0.5f);
+    scene.objects.push_back(sphere);
+
+    Object mirror;
+    mirror.type = OBJECT_SPHERE;
+    mirror.position = Vec3{2.2f, 0.8f, -0.5f};
+    mirror.scale = Vec3{0.8f, 0.8f, 0.8f};
+    mirror.material = makeMaterial(Vec3{0.0f, 0.0f, 0.0f}, Vec3{0.9f, 0.9f, 0.9f}, 0.0f);
+    scene.objects.push_back(mirror);
+
+    Object box;
+    box.type = OBJECT_BOX;
+    box.position = Vec3{-2.0f, 0.75f, -0.5f};
+    box.scale = Vec3{1.5f, 1.5f, 1.5f};
+    box.material = makeMaterial(Vec3{0.2f, 0.6f, 0.9f}, Vec3{0.0f, 0.0f, 0.0f}, 1.0f);
+    scene.objects.push_back(box);
+
+    Object lamp;
+    lamp.type = OBJECT_SPHERE;
+    lamp.position = Vec3{0.0f, 3.5f, -2.0f};
+    lamp.scale = Vec3{0.4f, 0.4f, 0.4f};
+    lamp.material = makeMaterial(Vec3{1.0f, 1.0f, 1.0f}, Vec3{0.0f, 0.0f, 0.0f}, 1.0f);
+    lamp.material.emission = Vec3{1.0f, 0.9f, 0.7f};
+    lamp.material.emissionStrength = 5.0f;
+    scene.objects.push_back(lamp);
+
+    PointLight light;
+    light.position = Vec3{3.0f, 5.0f, 3.0f};
+    light.radius = 0.5f;
+    light.color = Vec3{1.0f, 1.0f, 1.0f};
+    light.power = 40.0f;
+    light.reach = 100.0f;
+    scene.lights.push_back(light);
+
+    scene.planeVisible = true;
+    scene.planeMaterial = makeMaterial(Vec3{0.7f, 0.7f, 0.7f}, Vec3{0.05f, 0.05f, 0.05f}, 0.8f);
+
+    scene.settings.shadowResolution = 16;
+    scene.settings.lightBounces = 4;
+    scene.settings.framePasses = 1;
+    scene.settings.blur = 0.001f;
+    scene.settings.bloomRadius = 0.02f;
+    scene.settings.bloomIntensity = 0.1f;
+    scene.settings.skyboxStrength = 1.0f;
+    scene.settings.skyboxGamma = 1.0f;
+    scene.settings.skyboxCeiling = 10.0f;
+    scene.settings.skyCacheDepth = 0;
+
+    scene.skyboxPath = "textures/skybox.jpg";
+    return scene;
+}
+
+static const float DEGREES_TO_RADIANS = 3.14159265f / 180.0f;
+
+static bool readVec3(std::istringstream& line, Vec3& out) {
+    return (bool)(line >> out.x >> out.y >> out.z);
+}
+
+static bool readMaterial(std::istringstream& line, Material& material) {
+    Vec3 albedo, specular;
+    float roughness;
+    if (!readVec3(line, albedo) || !readVec3(line, specular) || !(line >> roughness)) return false;
+    Vec3 emission = material.emission;
+    float emissionStrength = material.emissionStrength;
+    material = makeMaterial(albedo, specular, roughness);
+    material.emission = emission;
+    material.emissionStrength = emissionStrength;
+    return true;
+}
+
+bool loadScene(const std::string& path, Scene& scene, Camera& camera) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+    return parseScene(file, path, scene, camera);
+}
+
+bool parseScene(std::istream& input, const std::string& path, Scene& scene, Camera& camera) {
+    Scene defaults = createDefaultScene();
+    scene = Scene();
+    scene.planeVisible = defaults.planeVisible;
+    scene.planeMaterial = defaults.planeMaterial;
+    scene.settings = defaults.settings;
+    scene.skyboxPath = defaults.skyboxPath;
+    camera = createDefaultCamera();
+
+    std::string text;
+    int lineNumber = 0;
+    while (std::getline(input, text)) {
+        lineNumber++;
+        std::istringstream line(text);
+        std::string keyword;
+        if (!(line >> keyword) || keyword[0] == '#') continue;
+
+        RenderSettings& settings = scene.settings;
+        Object* last = scene.objects.empty() ? NULL : &scene.objects.back();
+        bool ok = true;
+
+        if (keyword == "camera") {
+            float yaw, pitch;
+            ok = readVec3(line, camera.position) && (line >> yaw >> pitch);
+            camera.yaw = yaw * DEGREES_TO_RADIANS;
+            camera.pitch = pitch * DEGREES_TO_RADIANS;
+        } else if (keyword == "sphere" || keyword == "box") {
+            Object object;
+            object.type = (keyword == "sphere") ? OBJECT_SPHERE : OBJECT_BOX;
+            object.material = makeMaterial(Vec3{0.8f, 0.8f, 0.8f}, Vec3{0.0f, 0.0f, 0.0f}, 1.0f);
+            ok = readVec3(line, object.position);
+            if (object.type == OBJECT_SPHERE) {
+                ok = ok && (line >> object.scale.x);
+                object.scale.y = object.scale.z = object.scale.x;
+            } else {
+                ok = ok && readVec3(line, object.scale);
+            }
+            if (ok && (int)scene.objects.size() == MAX_OBJECT_COUNT) {
+                std::cerr << path << ":" << lineNumber << ": more than " << MAX_OBJECT_COUNT << " objects" << std::endl;
+                return false;
+            }
+            scene.objects.push_back(object);
+        } else if (keyword == "material" || keyword == "emission" || keyword == "highlight") {
+            // Applies to the object declared last
+            if (!last) {
+                std::cerr << path << ":" << lineNumber << ": " << keyword << " before any object" << std::endl;
+                return false;
+            }
+            if (keyword == "material") ok = readMaterial(line, last->material);
+            else if (keyword == "emission") ok = readVec3(line, last->material.emission) && (line >> last->material.emissionStrength);
+            else ok = (bool)(line >> last->material.specularHighlight >> last->material.specularExponent);
+        } else if (keyword == "light") {
+            PointLight light;
+            ok = readVec3(line, light.position) && (line >> light.radius) && readVec3(line, light.color) && (line >> light.power >> light.reach);
+            if (ok && (int)scene.lights.size() == MAX_LIGHT_COUNT) {
+                std::cerr << path << ":" << lineNumber << ": more than " << MAX_LIGHT_COUNT << " lights" << std::endl;
+                return false;
+            }
+            scene.lights.push_back(light);
+        } else if (keyword == "plane") {
+            std::string state;
+            ok = (line >> state) && (state == "on" || state == "off");
+            scene.planeVisible = (state == "on");
+        } else if (keyword == "plane_material") {
+            ok = readMaterial(line, scene.planeMaterial);
+        } else if (keyword == "skybox") {
+            ok = (bool)(line >> scene.skyboxPath);
+        } else if (keyword == "shadow_samples") {
+            ok = (bool)(line >> settings.shadowResolution);
+        } else if (keyword == "bounces") {
+            ok = (bool)(line >> settings.lightBounces);
+        } else if (keyword == "frame_passes") {
+            ok = (line >> settings.framePasses) && settings.framePasses > 0;
+        } else if (keyword == "blur") {
+            ok = (bool)(line >> settings.blur);
+        } else if (keyword == "bloom") {
+            ok = (bool)(line >> settings.bloomRadius >> settings.bloomIntensity);
+        } else if (keyword == "sky") {
+            ok = (bool)(line >> settings.skyboxStrength >> settings.skyboxGamma >> settings.skyboxCeiling);
+        } else if (keyword == "sky_cache") {
+            ok = (line >> settings.skyCacheDepth) && settings.skyCacheDepth >= 0;
+        } else {
+            std::cerr << path << ":" << lineNumber << ": unknown keyword " << keyword << std::endl;
+            return false;
+        }
+
+        if (!ok) {
+            std::cerr << path << ":" << lineNumber << ": malformed " << keyword << " line" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Fields are hashed one by one, struct padding would make the hash depend on garbage
+static void hashBytes(unsigned long long& hash, const void* data, size_t size) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+}
+
+static void hashFloat(unsigned long long& hash, float value) { hashBytes(hash, &value, sizeof(value)); }
+static void hashInt(unsigned long long& hash, int value) { hashBytes(hash, &value, sizeof(value)); }
+
+static void hashVec3(unsigned long long& hash, const Vec3& value) {
+    hashFloat(hash, value.x);
+    hashFloat(hash, value.y);
+    hashFloat(hash, value.z);
+}
+
+static void hashMaterial(unsigned long long& hash, const Material& material) {
+    hashVec3(hash, material.albedo);
+    hashVec3(hash, material.specular);
+    hashVec3(hash, material.emission);
+    hashFloat(hash, material.emissionStrength);
+    hashFloat(hash, material.roughness);
+    hashFloat(hash, material.specularHighlight);
+    hashFloat(hash, material.specularExponent);
+}
+
+unsigned long long hashScene(const Scene& scene, const Camera& camera) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < scene.objects.size(); ++i) {
+        const Object& object = scene.objects[i];
+        hashInt(hash, (int)object.type);
+        hashVec3(hash, object.position);
+        hashVec3(hash, object.scale);
+        hashMaterial(hash, object.material);
+    }
+    for (size_t i = 0; i < scene.lights.size(); ++i) {
+        const PointLight& light = scene.lights[i];
+        hashVec3(hash, light.position);
+        hashFloat(hash, light.radius);
+        hashVec3(hash, light.color);
+        hashFloat(hash, light.power);
+        hashFloat(hash, light.reach);
+    }
+    hashInt(hash, scene.planeVisible ? 1 : 0);
+    hashMaterial(hash, scene.planeMaterial);
+
+    const RenderSettings& settings = scene.settings;
+    hashInt(hash, settings.shadowResolution);
+    hashInt(hash, settings.lightBounces);
+    hashInt(hash, settings.framePasses);
+    hashFloat(hash, settings.blur);
+    hashFloat(hash, settings.bloomRadius);
+    hashFloat(hash, settings.bloomIntensity);
+    hashFloat(hash, settings.skyboxStrength);
+    hashFloat(hash, settings.skyboxGamma);
+    hashFloat(hash, settings.skyboxCeiling);
+    hashInt(hash, settings.skyCacheDepth);
+    hashBytes(hash, scene.skyboxPath.data(), scene.skyboxPath.size());
+
+    hashVec3(hash, camera.position);
+    hashFloat(hash, camera.yaw);
+    hashFloat(hash, camera.pitch);
+    return hash;
+}
@@ -0,0 +1,121 @@
+#include "shader.h"
+#include "utils.h"
+#include <iostream>
+
+unsigned int Shader::compileStage(GLenum type, const std::vector<std::string>& paths, const std::string& defines) {
+    std::string source;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        std::string part = readFile(paths[i]);
+        if (part.empty()) return 0;
+        source += part;
+        source += "\n";
+    }
+
+    if (!defines.empty()) {
+        size_t versionEnd = source.find('\n');
+        source.insert(versionEnd + 1, defines);
+    }
+
+    unsigned int shader = glCreateShader(type);
+    const char* sourcePtr = source.c_str();
+    glShaderSource(shader, 1, &sourcePtr, NULL);
+    glCompileShader(shader);
+
+    int success;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        char infoLog[1024];
+        glGetShaderInfoLog(shader, 1024, NULL, infoLog);
+        std::cerr << "Shader compilation failed (" << paths.back() << "):\n" << infoLog << std::endl;
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+unsigned int Shader::link(const std::vector<unsigned int>& stages) {
+    for (size_t i = 0; i < stages.size(); ++i) {
+        if (stages[i] == 0) {
+            for (size_t j = 0; j < stages.size(); ++j) glDeleteShader(stages[j]);
+            return 0;
+        }
+    }
+
+    unsigned int program = glCreateProgram();
+    for (size_t i = 0; i < stages.size(); ++i) glAttachShader(program, stages[i]);
+    glLinkProgram(program);
+    for (size_t i = 0; i < stages.size(); ++i) glDeleteShader(stages[i]);
+
+    int success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        char infoLog[1024];
+        glGetProgramInfoLog(program, 1024, NULL, infoLog);
+        std::cerr << "Shader linking failed:\n" << infoLog << std::endl;
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+Shader::Shader(const std::vector<std::string>& vertexPaths, const std::vector<std::string>& fragmentPaths) {
+    std::vector<unsigned int> stages;
+    stages.push_back(compileStage(GL_VERTEX_SHADER, vertexPaths));
+    stages.push_back(compileStage(GL_FRAGMENT_SHADER, fragmentPaths));
+    id = link(stages);
+}
+
+Shader::Shader(const std::vector<std::string>& computePaths, const std::string& defines) {
+    std::vector<unsigned int> stages;
+    stages.push_back(compileStage(GL_COMPUTE_SHADER, computePaths, defines));
+    id = link(stages);
+}
+
+Shader::~Shader() {
+    if (id) glDeleteProgram(id);
+}
+
+void Shader::use() const {
+    glUseProgram(id);
+}
+
+int Shader::location(const std::string& name) const {
+    std::unordered_map<std::string, int>::const_iterator it = m_locations.find(name);
+    if (it != m_locations.end()) return it->second;
+
+    int location = glGetUniformLocation(id, name.c_str());
+    m_locations[name] = location;
+    return location;
+}
+
+void Shader::setBool(const std::string& name, bool value) const {
+    glUniform1i(location(name), (int)value);
+}
+
+void Shader::setInt(const std::string& name, int value) const {
+    glUniform1i(location(name), value);
+}
+
+void Shader::setUint(const std::string& name, unsigned int value) const {
+    glUniform1ui(location(name), value);
+}
+
+void Shader::setFloat(const std::string& name, float value) const {
+    glUniform1f(location(name), value);
+}
+
+void Shader::setVec2i(const std::string& name, int x, int y) const {
+    glUniform2i(location(name), x, y);
+}
+
+void Shader::setVec3(const std::string& name, const float* value) const {
+    glUniform3fv(location(name), 1, value);
+}
+
+void Shader::setVec4(const std::string& name, float x, float y, float z, float w) const {
+    glUniform4f(location(name), x, y, z, w);
+}
+
+void Shader::setMat4(const std::string& name, const float* value) const {
+    glUniformMatrix4fv(location(name), 1, GL_FALSE, value);
+}
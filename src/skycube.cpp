@@ -0,0 +1,174 @@
+#include "skycube.h"
+#include <algorithm>
+#include <cmath>
+
+static const float PI = 3.14159265358979323846f;
+
+// Direction through texel coordinates s, t in [-1, 1] of a cube face, from the face table of the GL spec
+static void faceDirection(int face, float s, float t, float dir[3]) {
+    switch (face) {
+    case 0: dir[0] = 1.0f; dir[1] = -t; dir[2] = -s; break;
+    case 1: dir[0] = -1.0f; dir[1] = -t; dir[2] = s; break;
+    case 2: dir[0] = s; dir[1] = 1.0f; dir[2] = t; break;
+    case 3: dir[0] = s; dir[1] = -1.0f; dir[2] = -t; break;
+    case 4: dir[0] = s; dir[1] = -t; dir[2] = 1.0f; break;
+    default: dir[0] = -s; dir[1] = -t; dir[2] = -1.0f; break;
+    }
+    float length = std::sqrt(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+    for (int c = 0; c < 3; ++c) dir[c] /= length;
+}
+
+void bakeSkyCube(const float* radiance, int width, int height, int faceSize, std::vector<float>& faces) {
+    size_t faceTexels = (size_t)faceSize * faceSize;
+    faces.assign(6 * faceTexels * 3, 0.0f);
+    for (int face = 0; face < 6; ++face) {
+        for (int y = 0; y < faceSize; ++y) {
+            for (int x = 0; x < faceSize; ++x) {
+                float dir[3];
+                faceDirection(face, 2.0f * (x + 0.5f) / faceSize - 1.0f, 2.0f * (y + 0.5f) / faceSize - 1.0f, dir);
+
+                // The mapping the shader used: wraps around horizontally, clamps at the poles
+                float u = 0.5f + std::atan2(dir[0], dir[2]) / (2.0f * PI);
+                float v = 0.5f + std::asin(std::max(-1.0f, std::min(1.0f, -dir[1]))) / PI;
+                float fx = u * width - 0.5f;
+                float fy = std::max(0.0f, std::min(v * height - 0.5f, height - 1.0f));
+                int x0 = (int)std::floor(fx);
+                int y0 = (int)fy;
+                float ax = fx - x0;
+                float ay = fy - y0;
+                int y1 = std::min(y0 + 1, height - 1);
+                x0 = ((x0 % width) + width) % width;
+                int x1 = (x0 + 1) % width;
+
+                const float* texels[4] = {
+                    radiance + ((size_t)y0 * width + x0) * 3, radiance + ((size_t)y0 * width + x1) * 3,
+                    radiance + ((size_t)y1 * width + x0) * 3, radiance + ((size_t)y1 * width + x1) * 3};
+                float* out = &faces[(face * faceTexels + (size_t)y * faceSize + x) * 3];
+                for (int c = 0; c < 3; ++c) {
+                    float top = texels[0][c] + (texels[1][c] - texels[0][c]) * ax;
+                    float bottom = texels[2][c] + (texels[3][c] - texels[2][c]) * ax;
+                    out[c] = top + (bottom - top) * ay;
+                }
+            }
+        }
+    }
+}
+
+// Solid angle of texel x, y of a face, for weighting texels that are smaller towards the face corners
+static float texelSolidAngle(int faceSize, int x, int y) {
+    float s = 2.0f * (x + 0.5f) / faceSize - 1.0f;
+    float t = 2.0f * (y + 0.5f) / faceSize - 1.0f;
+    float distanceSquared = 1.0f + s * s + t * t;
+    return 4.0f / ((float)faceSize * faceSize * distanceSquared * std::sqrt(distanceSquared));
+}
+
+void downsampleSkyCube(const std::vector<float>& faces, int faceSize, int size, std::vector<float>& out) {
+    size_t outTexels = (size_t)6 * size * size;
+    out.assign(outTexels * 3, 0.0f);
+    std::vector<float> weights(outTexels, 0.0f);
+    for (int face = 0; face < 6; ++face) {
+        for (int y = 0; y < faceSize; ++y) {
+            for (int x = 0; x < faceSize; ++x) {
+                float weight = texelSolidAngle(faceSize, x, y);
+                const float* in = &faces[(((size_t)face * faceSize + y) * faceSize + x) * 3];
+                size_t texel = ((size_t)face * size + (size_t)y * size / faceSize) * size + (size_t)x * size / faceSize;
+                for (int c = 0; c < 3; ++c) out[texel * 3 + c] += in[c] * weight;
+                weights[texel] += weight;
+            }
+        }
+    }
+    for (size_t i = 0; i < outTexels; ++i) {
+        for (int c = 0; c < 3; ++c) out[i * 3 + c] /= weights[i];
+    }
+}
+
+void prefilterSkyCube(const std::vector<float>& faces, int faceSize, int levels, std::vector<std::vector<float> >& mips) {
+    // Direction and solid angle of every source texel, looked up once per destination texel
+    size_t texels = (size_t)6 * faceSize * faceSize;
+    std::vector<float> directions(texels * 3), solidAngles(texels);
+    for (int face = 0; face < 6; ++face) {
+        for (int y = 0; y < faceSize; ++y) {
+            for (int x = 0; x < faceSize; ++x) {
+                size_t i = ((size_t)face * faceSize + y) * faceSize + x;
+                faceDirection(face, 2.0f * (x + 0.5f) / faceSize - 1.0f, 2.0f * (y + 0.5f) / faceSize - 1.0f, &directions[i * 3]);
+                solidAngles[i] = texelSolidAngle(faceSize, x, y);
+            }
+        }
+    }
+
+    mips.assign(levels, std::vector<float>());
+    mips[0] = faces; // Smooth enough to reflect the sky at this size
+    for (int level = 1; level < levels; ++level) {
+        int size = faceSize >> level;
+        float smoothness = 1.0f - (float)level / (levels - 1);
+        // The lobe sampleHemisphere() draws rough specular bounces from
+        float alpha = std::pow(1000.0f, smoothness * smoothness);
+        std::vector<float>& mip = mips[level];
+        mip.assign((size_t)6 * size * size * 3, 0.0f);
+        for (int face = 0; face < 6; ++face) {
+            for (int y = 0; y < size; ++y) {
+                for (int x = 0; x < size; ++x) {
+                    float dir[3];
+                    faceDirection(face, 2.0f * (x + 0.5f) / size - 1.0f, 2.0f * (y + 0.5f) / size - 1.0f, dir);
+                    double sum[3] = {0.0, 0.0, 0.0};
+                    double weightSum = 0.0;
+                    for (size_t i = 0; i < texels; ++i) {
+                        const float* other = &directions[i * 3];
+                        float cosine = dir[0] * other[0] + dir[1] * other[1] + dir[2] * other[2];
+                        if (cosine <= 0.0f) continue;
+                        double weight = std::pow(cosine, alpha) * solidAngles[i];
+                        for (int c = 0; c < 3; ++c) sum[c] += weight * faces[i * 3 + c];
+                        weightSum += weight;
+                    }
+                    float* out = &mip[(((size_t)face * size + y) * size + x) * 3];
+                    for (int c = 0; c < 3; ++c) out[c] = (float)(sum[c] / weightSum);
+                }
+            }
+        }
+    }
+}
+
+// Real spherical harmonics up to order 3, in the order of the coefficients of projectSkyDiffuse()
+static void shBasis(const float* d, float basis[SKY_DIFFUSE_COEFFICIENTS]) {
+    float x = d[0], y = d[1], z = d[2];
+    basis[0] = 0.282095f;
+    basis[1] = 0.488603f * y;
+    basis[2] = 0.488603f * z;
+    basis[3] = 0.488603f * x;
+    basis[4] = 1.092548f * x * y;
+    basis[5] = 1.092548f * y * z;
+    basis[6] = 0.315392f * (3.0f * z * z - 1.0f);
+    basis[7] = 1.092548f * x * z;
+    basis[8] = 0.546274f * (x * x - y * y);
+    basis[9] = 0.590044f * y * (3.0f * x * x - y * y);
+    basis[10] = 2.890611f * x * y * z;
+    basis[11] = 0.457046f * y * (5.0f * z * z - 1.0f);
+    basis[12] = 0.373176f * z * (5.0f * z * z - 3.0f);
+    basis[13] = 0.457046f * x * (5.0f * z * z - 1.0f);
+    basis[14] = 1.445306f * z * (x * x - y * y);
+    basis[15] = 0.590044f * x * (x * x - 3.0f * y * y);
+}
+
+void projectSkyDiffuse(const std::vector<float>& faces, int faceSize, float coefficients[SKY_DIFFUSE_COEFFICIENTS][3]) {
+    double sums[SKY_DIFFUSE_COEFFICIENTS][3] = {};
+    for (int face = 0; face < 6; ++face) {
+        for (int y = 0; y < faceSize; ++y) {
+            for (int x = 0; x < faceSize; ++x) {
+                float dir[3], basis[SKY_DIFFUSE_COEFFICIENTS];
+                faceDirection(face, 2.0f * (x + 0.5f) / faceSize - 1.0f, 2.0f * (y + 0.5f) / faceSize - 1.0f, dir);
+                shBasis(dir, basis);
+                float solidAngle = texelSolidAngle(faceSize, x, y);
+                const float* rgb = &faces[(((size_t)face * faceSize + y) * faceSize + x) * 3];
+                for (int i = 0; i < SKY_DIFFUSE_COEFFICIENTS; ++i) {
+                    for (int c = 0; c < 3; ++c) sums[i][c] += rgb[c] * basis[i] * solidAngle;
+                }
+            }
+        }
+    }
+    // Convolution with max(cos, 0)^2 / PI scales order l by 2 times the integral of t^2 P_l(t) over [0, 1]
+    static const float bandScale[4] = {2.0f / 3.0f, 1.0f / 2.0f, 4.0f / 15.0f, 1.0f / 12.0f};
+    for (int i = 0; i < SKY_DIFFUSE_COEFFICIENTS; ++i) {
+        int band = i < 1 ? 0 : i < 4 ? 1 : i < 9 ? 2 : 3;
+        for (int c = 0; c < 3; ++c) coefficients[i][c] = (float)sums[i][c] * bandScale[band];
+    }
+}
@@ -0,0 +1,54 @@
+#include "skysampler.h"
+#include <cmath>
+
+static const double PI = 3.14159265358979323846;
+
+bool buildSkySampler(const float* radiance, int width, int height, SkySampler& sampler) {
+    size_t count = (size_t)width * height;
+    sampler.width = width;
+    sampler.height = height;
+    sampler.table.assign(count * 4, 0.0f);
+
+    // Texels shrink towards the poles, by the sine of their polar angle
+    std::vector<double> weights(count);
+    double total = 0.0;
+    for (int y = 0; y < height; ++y) {
+        double solidAngle = std::sin(PI * (y + 0.5) / height);
+        for (int x = 0; x < width; ++x) {
+            size_t i = (size_t)y * width + x;
+            const float* rgb = radiance + i * 3;
+            double luminance = 0.2126 * rgb[0] + 0.7152 * rgb[1] + 0.0722 * rgb[2];
+            weights[i] = luminance > 0.0 ? luminance * solidAngle : 0.0;
+            total += weights[i];
+        }
+    }
+    if (!(total > 0.0)) {
+        sampler.table.clear();
+        return false;
+    }
+
+    // Every slot holds one unit of probability: a texel below 1 is topped up with part of one above 1
+    std::vector<double> scaled(count);
+    std::vector<size_t> small, large;
+    for (size_t i = 0; i < count; ++i) {
+        scaled[i] = weights[i] * count / total;
+        sampler.table[i * 4 + 2] = (float)scaled[i];
+        (scaled[i] < 1.0 ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty()) {
+        size_t less = small.back();
+        small.pop_back();
+        size_t more = large.back();
+        sampler.table[less * 4 + 0] = (float)scaled[less];
+        sampler.table[less * 4 + 1] = (float)more;
+        scaled[more] -= 1.0 - scaled[less];
+        if (scaled[more] < 1.0) {
+            large.pop_back();
+            small.push_back(more);
+        }
+    }
+    // Whatever is left is 1 up to rounding
+    for (size_t i = 0; i < small.size(); ++i) sampler.table[small[i] * 4 + 0] = 1.0f;
+    for (size_t i = 0; i < large.size(); ++i) sampler.table[large[i] * 4 + 0] = 1.0f;
+    return true;
+}
@@ -1,4 +1,3 @@
-#define STB_IMAGE_IMPLEMENTATION
 #include <cmath>
 #include <vector>
 #include <iostream>
@@ -7,7 +6,8 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
-#include "../include/stb_image.h"
+#include "../include/texturecache.h"
+#include "../include/textureloader.h"
 
 // Vertex Shader Source
 const char* vertexShaderSource = R"(
@@ -93,30 +93,50 @@ GLuint compileShader(GLenum type, const char* source) {
     return shader;
 }
 
-// Load texture
-GLuint loadTexture(const char* path) {
+// Uploads a decoded texture with the mip levels the loader built, in the format of its channel count
+GLuint loadTexture(const TextureRequest& request) {
     GLuint textureID;
     glGenTextures(1, &textureID);
-    
-    int width, height, channels;
-    unsigned char* data = stbi_load(path, &width, &height, &channels, 0);
-    if (data) {
+
+    if (request.wait()) {
+        static const GLenum formats[4] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+        static const GLenum hdrFormats[4] = {GL_R16F, GL_RG16F, GL_RGB16F, GL_RGBA16F};
+        const TextureImage& image = request.image();
+        GLenum format = formats[image.channels - 1];
         glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (size_t level = 0; level < image.levels.size(); ++level) {
+            const TextureLevel& pixels = image.levels[level];
+            if (image.hdr) {
+                glTexImage2D(GL_TEXTURE_2D, (GLint)level, hdrFormats[image.channels - 1], pixels.width, pixels.height, 0, format, GL_FLOAT,
+                             pixels.floats());
+            } else {
+                glTexImage2D(GL_TEXTURE_2D, (GLint)level, format, pixels.width, pixels.height, 0, format, GL_UNSIGNED_BYTE, pixels.bytes());
+            }
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        if (image.channels <= 2) {
+            // Grey (and alpha) images: grey in every color channel
+            GLint swizzle[4] = {GL_RED, GL_RED, GL_RED, image.channels == 2 ? GL_GREEN : GL_ONE};
+            glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.levels.size() - 1);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     } else {
-        std::cerr << "Failed to load texture" << std::endl;
+        std::cerr << "Failed to load texture " << request.path() << ": " << request.error() << std::endl;
     }
-    stbi_image_free(data);
-    
+
     return textureID;
 }
 
 int main() {
+    // Decodes while the window and context are created, or maps the mips cached by an earlier run
+    TextureLoader textureLoader(0, defaultTextureCacheDirectory());
+    std::shared_ptr<TextureRequest> earthTexture = textureLoader.load("earth_texture.jpg", 0, true);
+
     if (!glfwInit()) {
         return -1;
     }
@@ -173,7 +193,10 @@ int main() {
     glDeleteShader(vertexShader);
     glDeleteShader(fragmentShader);
 
-    GLuint texture = loadTexture("earth_texture.jpg");
+    GLuint texture = loadTexture(*earthTexture);
+
+    // Uniform locations don't change after linking, so look them up once
+    GLint mvpLocation = glGetUniformLocation(shaderProgram, "mvp");
 
     while (!glfwWindowShouldClose(window)) {
         // Clear buffers
@@ -193,7 +216,7 @@ int main() {
         glm::mat4 mvp = projection * view * model;
 
         // Send MVP matrix to shader
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "mvp"), 1, GL_FALSE, glm::value_ptr(mvp));
+        glUniformMatrix4fv(mvpLocation, 1, GL_FALSE, glm::value_ptr(mvp));
 
         // Draw the sphere
         glBindVertexArray(VAO);
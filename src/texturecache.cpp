@@ -0,0 +1,170 @@
+#include "texturecache.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+static const char TEXTURE_CACHE_MAGIC[8] = {'R', 'T', 'T', 'E', 'X', 'C', 'A', '1'};
+static const size_t LEVEL_ALIGNMENT = 64; // Texel offsets, from the start of the file
+
+struct CacheHeader {
+    char magic[8];
+    unsigned long long contentHash;
+    int channels;
+    int hdr;
+    int levelCount;
+    int padding;
+};
+
+struct CacheLevel {
+    int width;
+    int height;
+    unsigned long long offset;
+};
+
+static size_t alignUp(size_t value) {
+    return (value + LEVEL_ALIGNMENT - 1) / LEVEL_ALIGNMENT * LEVEL_ALIGNMENT;
+}
+
+static size_t levelSize(const TextureImage& image, int width, int height) {
+    return (size_t)width * height * image.channels * (image.hdr ? sizeof(float) : 1);
+}
+
+static unsigned long long rotateLeft(unsigned long long value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// MurmurHash3's 64-bit mixing, one lane: a few GB/s, so hashing a source file costs far less than
+// decoding it
+unsigned long long hashContents(const unsigned char* data, size_t size) {
+    const unsigned long long c1 = 0x87c37b91114253d5ULL, c2 = 0x4cf5ad432745937fULL;
+    unsigned long long hash = size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        unsigned long long word;
+        memcpy(&word, data + i, 8);
+        hash ^= rotateLeft(word * c1, 31) * c2;
+        hash = rotateLeft(hash, 27) * 5 + 0x52dce729;
+    }
+    unsigned long long tail = 0;
+    for (size_t j = 0; i + j < size; ++j) tail |= (unsigned long long)data[i + j] << (8 * j);
+    hash ^= rotateLeft(tail * c1, 31) * c2;
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+std::string textureCachePath(const std::string& directory, unsigned long long contentHash, int channels, bool mipmaps) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx-%d%s.tex", contentHash, channels, mipmaps ? "m" : "");
+    return directory + "/" + name;
+}
+
+bool mapTextureCache(const std::string& path, unsigned long long contentHash, TextureImage& image) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        return false;
+    }
+    size_t size = (size_t)info.st_size;
+    void* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps the file
+    if (mapped == MAP_FAILED) return false;
+    std::shared_ptr<const void> memory(mapped, [size](const void* address) { munmap((void*)address, size); });
+
+    const unsigned char* file = (const unsigned char*)mapped;
+    CacheHeader header;
+    memcpy(&header, file, sizeof(header));
+    if (memcmp(header.magic, TEXTURE_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.contentHash != contentHash ||
+        header.channels < 1 || header.channels > 4 || header.levelCount < 1 ||
+        sizeof(CacheHeader) + (size_t)header.levelCount * sizeof(CacheLevel) > size) {
+        return false;
+    }
+    image.channels = header.channels;
+    image.hdr = header.hdr != 0;
+    image.levels.assign(header.levelCount, TextureLevel());
+    for (int i = 0; i < header.levelCount; ++i) {
+        CacheLevel level;
+        memcpy(&level, file + sizeof(CacheHeader) + i * sizeof(CacheLevel), sizeof(level));
+        if (level.width < 1 || level.height < 1 || level.offset % LEVEL_ALIGNMENT != 0 ||
+            level.offset + levelSize(image, level.width, level.height) > size) {
+            return false;
+        }
+        image.levels[i].width = level.width;
+        image.levels[i].height = level.height;
+        image.levels[i].texels = file + level.offset;
+    }
+    image.memory = memory;
+    return true;
+}
+
+// mkdir -p
+static bool createDirectories(const std::string& directory) {
+    for (size_t slash = directory.find('/', 1); ; slash = directory.find('/', slash + 1)) {
+        std::string prefix = directory.substr(0, slash);
+        if (mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) return false;
+        if (slash == std::string::npos) return true;
+    }
+}
+
+bool writeTextureCache(const std::string& path, unsigned long long contentHash, const TextureImage& image) {
+    size_t slash = path.rfind('/');
+    if (slash != std::string::npos && !createDirectories(path.substr(0, slash))) return false;
+
+    CacheHeader header;
+    memcpy(header.magic, TEXTURE_CACHE_MAGIC, sizeof(header.magic));
+    header.contentHash = contentHash;
+    header.channels = image.channels;
+    header.hdr = image.hdr ? 1 : 0;
+    header.levelCount = (int)image.levels.size();
+    header.padding = 0;
+    std::vector<unsigned char> table(sizeof(CacheHeader) + image.levels.size() * sizeof(CacheLevel));
+    memcpy(&table[0], &header, sizeof(header));
+    size_t offset = alignUp(table.size());
+    for (size_t i = 0; i < image.levels.size(); ++i) {
+        CacheLevel level = {image.levels[i].width, image.levels[i].height, offset};
+        memcpy(&table[sizeof(CacheHeader) + i * sizeof(CacheLevel)], &level, sizeof(level));
+        offset = alignUp(offset + levelSize(image, level.width, level.height));
+    }
+
+    // Unique per process and thread, two loaders may write the same texture at once
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), ".%d.%p.tmp", (int)getpid(), (const void*)&image);
+    std::string temporary = path + suffix;
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (!file) return false;
+    bool ok = fwrite(&table[0], 1, table.size(), file) == table.size();
+    size_t written = table.size();
+    static const unsigned char zeros[LEVEL_ALIGNMENT] = {};
+    for (size_t i = 0; ok && i < image.levels.size(); ++i) {
+        size_t padding = alignUp(written) - written;
+        size_t size = levelSize(image, image.levels[i].width, image.levels[i].height);
+        ok = fwrite(zeros, 1, padding, file) == padding && fwrite(image.levels[i].texels, 1, size, file) == size;
+        written += padding + size;
+    }
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::string defaultTextureCacheDirectory() {
+    const char* cacheHome = getenv("XDG_CACHE_HOME");
+    if (cacheHome && cacheHome[0]) return std::string(cacheHome) + "/raytracer/textures";
+    const char* home = getenv("HOME");
+    if (home && home[0]) return std::string(home) + "/.cache/raytracer/textures";
+    return "";
+}
@@ -0,0 +1,190 @@
+#define STB_IMAGE_IMPLEMENTATION
+#include "textureloader.h"
+#include "stb_image.h"
+#include "texturecache.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+TextureRequest::TextureRequest(const std::string& path, int channels, bool mipmaps)
+    : m_path(path), m_channels(channels), m_mipmaps(mipmaps), m_done(false), m_ok(false) {
+    m_image.channels = 0;
+    m_image.hdr = false;
+}
+
+bool TextureRequest::ready() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_done;
+}
+
+bool TextureRequest::wait() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_finished.wait(lock, [this] { return m_done; });
+    return m_ok;
+}
+
+// Averages 2x2 blocks of the previous level, the last row or column of odd sizes is averaged with itself
+template <typename T>
+static void downsample(const T* in, int width, int height, int channels, T* out, int outWidth, int outHeight, float rounding) {
+    for (int y = 0; y < outHeight; ++y) {
+        int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+        for (int x = 0; x < outWidth; ++x) {
+            int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+            for (int c = 0; c < channels; ++c) {
+                float sum = (float)in[((size_t)y0 * width + x0) * channels + c] + (float)in[((size_t)y0 * width + x1) * channels + c] +
+                            (float)in[((size_t)y1 * width + x0) * channels + c] + (float)in[((size_t)y1 * width + x1) * channels + c];
+                out[((size_t)y * outWidth + x) * channels + c] = (T)(sum * 0.25f + rounding);
+            }
+        }
+    }
+}
+
+static bool readContents(const std::string& path, std::vector<unsigned char>& contents) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+    bool ok = fseek(file, 0, SEEK_END) == 0;
+    long size = ok ? ftell(file) : -1;
+    ok = size >= 0 && fseek(file, 0, SEEK_SET) == 0;
+    if (ok) {
+        contents.resize((size_t)size);
+        ok = size == 0 || fread(&contents[0], 1, (size_t)size, file) == (size_t)size;
+    }
+    fclose(file);
+    return ok;
+}
+
+// Decodes into one buffer holding every level, so the image can be written to the cache as it is
+static bool decode(const std::vector<unsigned char>& contents, int channels, bool mipmaps, TextureImage& image, std::string& error) {
+    const stbi_uc* file = contents.data();
+    int fileSize = (int)contents.size();
+    int width, height, fileChannels;
+    image.hdr = stbi_is_hdr_from_memory(file, fileSize) != 0;
+    void* data = image.hdr ? (void*)stbi_loadf_from_memory(file, fileSize, &width, &height, &fileChannels, channels)
+                           : (void*)stbi_load_from_memory(file, fileSize, &width, &height, &fileChannels, channels);
+    if (!data) {
+        error = stbi_failure_reason();
+        return false;
+    }
+    image.channels = channels ? channels : fileChannels;
+    size_t texelSize = image.channels * (image.hdr ? sizeof(float) : 1);
+
+    std::vector<size_t> offsets;
+    image.levels.clear();
+    size_t size = 0;
+    for (int w = width, h = height;; w = std::max(w / 2, 1), h = std::max(h / 2, 1)) {
+        TextureLevel level = {w, h, NULL};
+        image.levels.push_back(level);
+        offsets.push_back(size);
+        size += (size_t)w * h * texelSize;
+        if (!mipmaps || (w == 1 && h == 1)) break;
+    }
+    std::shared_ptr<std::vector<unsigned char> > buffer = std::make_shared<std::vector<unsigned char> >(size);
+    for (size_t i = 0; i < image.levels.size(); ++i) image.levels[i].texels = buffer->data() + offsets[i];
+    image.memory = std::shared_ptr<const void>(buffer, buffer->data());
+
+    memcpy(buffer->data(), data, (size_t)width * height * texelSize);
+    stbi_image_free(data);
+    for (size_t i = 1; i < image.levels.size(); ++i) {
+        const TextureLevel& previous = image.levels[i - 1];
+        const TextureLevel& level = image.levels[i];
+        if (image.hdr) {
+            downsample(previous.floats(), previous.width, previous.height, image.channels, (float*)level.texels, level.width,
+                       level.height, 0.0f);
+        } else {
+            downsample(previous.bytes(), previous.width, previous.height, image.channels, (unsigned char*)level.texels, level.width,
+                       level.height, 0.5f);
+        }
+    }
+    return true;
+}
+
+// Maps the cached decode of contents, or decodes and caches it
+static bool loadImage(const std::string& path, const std::string& cacheDirectory, int channels, bool mipmaps, TextureImage& image,
+                      std::string& error) {
+    std::vector<unsigned char> contents;
+    if (!readContents(path, contents)) {
+        error = "can't read file";
+        return false;
+    }
+    if (cacheDirectory.empty()) return decode(contents, channels, mipmaps, image, error);
+
+    unsigned long long hash = hashContents(contents.data(), contents.size());
+    std::string cachePath = textureCachePath(cacheDirectory, hash, channels, mipmaps);
+    if (mapTextureCache(cachePath, hash, image)) return true;
+    if (!decode(contents, channels, mipmaps, image, error)) return false;
+    if (!writeTextureCache(cachePath, hash, image)) std::cerr << "Couldn't write texture cache " << cachePath << std::endl;
+    return true;
+}
+
+TextureLoader::TextureLoader(int threadCount, const std::string& cacheDirectory) : m_cacheDirectory(cacheDirectory), m_stop(false) {
+    if (threadCount <= 0) threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+    for (int i = 0; i < threadCount; ++i) m_workers.push_back(std::thread(&TextureLoader::workerLoop, this));
+}
+
+TextureLoader::~TextureLoader() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (size_t i = 0; i < m_workers.size(); ++i) m_workers[i].join();
+    for (size_t i = 0; i < m_queue.size(); ++i) {
+        TextureRequest& request = *m_queue[i];
+        std::lock_guard<std::mutex> lock(request.m_mutex);
+        request.m_error = "loader shut down";
+        request.m_done = true;
+        request.m_finished.notify_all();
+    }
+}
+
+static std::string requestKey(const std::string& path, int channels, bool mipmaps) {
+    return path + (char)('0' + channels) + (mipmaps ? 'm' : '-');
+}
+
+std::shared_ptr<TextureRequest> TextureLoader::load(const std::string& path, int channels, bool mipmaps) {
+    std::string key = requestKey(path, channels, mipmaps);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::shared_ptr<TextureRequest> request = m_requests[key].lock();
+    if (request) return request;
+
+    request = std::make_shared<TextureRequest>(path, channels, mipmaps);
+    m_requests[key] = request;
+    m_queue.push_back(request);
+    m_wake.notify_one();
+    return request;
+}
+
+void TextureLoader::workerLoop() {
+    for (;;) {
+        std::shared_ptr<TextureRequest> request;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+            if (m_stop) return;
+            request = m_queue.front();
+            m_queue.pop_front();
+            // Forget requests nobody holds anymore, the next load() of the path starts afresh
+            for (std::map<std::string, std::weak_ptr<TextureRequest> >::iterator it = m_requests.begin(); it != m_requests.end();) {
+                if (it->second.expired()) it = m_requests.erase(it);
+                else ++it;
+            }
+            // Dropped by everyone who asked (a scene replaced before its first pass), nothing to decode
+            // for. load() can't pick it up again once it's out of m_requests.
+            if (request.use_count() == 1) {
+                m_requests.erase(requestKey(request->m_path, request->m_channels, request->m_mipmaps));
+                continue;
+            }
+        }
+
+        TextureImage image;
+        std::string error;
+        bool ok = loadImage(request->m_path, m_cacheDirectory, request->m_channels, request->m_mipmaps, image, error);
+        std::lock_guard<std::mutex> lock(request->m_mutex);
+        request->m_image = image;
+        request->m_error = error;
+        request->m_ok = ok;
+        request->m_done = true;
+        request->m_finished.notify_all();
+    }
+}
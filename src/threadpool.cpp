@@ -0,0 +1,67 @@
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(int threadCount)
+    : m_job(NULL), m_count(0), m_chunkSize(1), m_nextChunk(0), m_generation(0), m_busyWorkers(0), m_stop(false) {
+    if (threadCount <= 0) threadCount = (int)std::thread::hardware_concurrency();
+    if (threadCount <= 0) threadCount = 1;
+
+    for (int i = 0; i < threadCount - 1; ++i) {
+        m_workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (size_t i = 0; i < m_workers.size(); ++i) m_workers[i].join();
+}
+
+void ThreadPool::runChunks() {
+    while (true) {
+        int begin = m_nextChunk.fetch_add(m_chunkSize);
+        if (begin >= m_count) break;
+        int end = begin + m_chunkSize < m_count ? begin + m_chunkSize : m_count;
+        (*m_job)(begin, end);
+    }
+}
+
+void ThreadPool::workerLoop() {
+    unsigned int seenGeneration = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&]() { return m_stop || m_generation != seenGeneration; });
+            if (m_stop) return;
+            seenGeneration = m_generation;
+        }
+
+        runChunks();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_busyWorkers == 0) m_done.notify_one();
+    }
+}
+
+void ThreadPool::parallelFor(int count, int chunkSize, const std::function<void(int, int)>& fn) {
+    if (count <= 0) return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_job = &fn;
+        m_count = count;
+        m_chunkSize = chunkSize > 0 ? chunkSize : 1;
+        m_nextChunk.store(0);
+        m_busyWorkers = (int)m_workers.size();
+        m_generation++;
+    }
+    m_wake.notify_all();
+
+    runChunks();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [&]() { return m_busyWorkers == 0; });
+    m_job = NULL;
+}
@@ -0,0 +1,165 @@
+#include "tiledtexture.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+TiledTexture::TiledTexture(const TextureImage& image, int tileSize, size_t budgetBytes)
+    : m_image(image), m_tileSize(tileSize), m_hand(0), m_hits(0), m_misses(0), m_bypassed(0), m_loads(0) {
+    m_texelSize = image.channels * (image.hdr ? sizeof(float) : 1);
+    m_tileBytes = (size_t)tileSize * tileSize * m_texelSize;
+    m_maxTiles = (int)std::max(budgetBytes / m_tileBytes, (size_t)1);
+    m_levels.resize(image.levels.size());
+    for (size_t i = 0; i < m_levels.size(); ++i) {
+        Level& level = m_levels[i];
+        level.width = image.levels[i].width;
+        level.height = image.levels[i].height;
+        level.tilesX = (level.width + tileSize - 1) / tileSize;
+        level.tilesY = (level.height + tileSize - 1) / tileSize;
+        int pageCount = level.tilesX * level.tilesY;
+        level.pages.reset(new std::atomic<Tile*>[pageCount]);
+        for (int page = 0; page < pageCount; ++page) level.pages[page].store(NULL, std::memory_order_relaxed);
+    }
+    TileStats empty = {0, 0, 0, 0, 0, 0};
+    m_lastFrame = empty;
+}
+
+TiledTexture::~TiledTexture() {
+    for (size_t i = 0; i < m_tiles.size(); ++i) delete m_tiles[i];
+}
+
+// Copies the tile out of the image under the lock, a second thread missing the same tile waits for it
+// instead of copying it again. Returns NULL if every tile the budget allows is in use.
+TiledTexture::Tile* TiledTexture::loadTile(int level, int index) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Level& pages = m_levels[level];
+    Tile* tile = pages.pages[index].load(std::memory_order_acquire);
+    if (tile) return tile;
+
+    if (!m_free.empty()) {
+        tile = m_free.back();
+        m_free.pop_back();
+    } else if ((int)m_tiles.size() < m_maxTiles) {
+        tile = new Tile();
+        tile->texels.resize(m_tileBytes);
+        m_tiles.push_back(tile);
+    } else {
+        return NULL;
+    }
+    tile->level = level;
+    tile->index = index;
+    tile->referenced.store(true, std::memory_order_relaxed);
+    const TextureLevel& source = m_image.levels[level];
+    int x0 = index % pages.tilesX * m_tileSize;
+    int y0 = index / pages.tilesX * m_tileSize;
+    int columns = std::min(m_tileSize, pages.width - x0);
+    int rows = std::min(m_tileSize, pages.height - y0);
+    for (int y = 0; y < rows; ++y) {
+        memcpy(&tile->texels[(size_t)y * m_tileSize * m_texelSize],
+               source.bytes() + ((size_t)(y0 + y) * pages.width + x0) * m_texelSize, (size_t)columns * m_texelSize);
+    }
+    m_loads++;
+    // release: the texels are written before another thread can find the tile
+    pages.pages[index].store(tile, std::memory_order_release);
+    return tile;
+}
+
+void TiledTexture::readTexel(const unsigned char* texels, size_t texel, float* rgba) const {
+    size_t offset = texel * m_image.channels;
+    float values[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    for (int c = 0; c < m_image.channels; ++c) {
+        values[c] = m_image.hdr ? ((const float*)texels)[offset + c] : texels[offset + c] / 255.0f;
+    }
+    bool grey = m_image.channels <= 2;
+    rgba[0] = values[0];
+    rgba[1] = grey ? values[0] : values[1];
+    rgba[2] = grey ? values[0] : values[2];
+    rgba[3] = m_image.channels == 2 ? values[1] : m_image.channels == 4 ? values[3] : 1.0f;
+}
+
+void TiledTexture::fetch(int level, int x, int y, float* rgba, TileCounts& counts) {
+    const Level& pages = m_levels[level];
+    x %= pages.width;
+    y %= pages.height;
+    if (x < 0) x += pages.width;
+    if (y < 0) y += pages.height;
+    int index = y / m_tileSize * pages.tilesX + x / m_tileSize;
+    Tile* tile = pages.pages[index].load(std::memory_order_acquire);
+    if (tile) {
+        counts.hits++;
+    } else {
+        counts.misses++;
+        tile = loadTile(level, index);
+        if (!tile) {
+            counts.bypassed++;
+            readTexel(m_image.levels[level].bytes(), (size_t)y * pages.width + x, rgba);
+            return;
+        }
+    }
+    // Only written when it changes, hits on a tile within a frame don't bounce its cache line around
+    if (!tile->referenced.load(std::memory_order_relaxed)) tile->referenced.store(true, std::memory_order_relaxed);
+    readTexel(tile->texels.data(), (size_t)(y % m_tileSize) * m_tileSize + x % m_tileSize, rgba);
+}
+
+void TiledTexture::sample(float u, float v, float lod, float* rgba, TileCounts& counts) {
+    int level = std::min(std::max((int)std::floor(lod + 0.5f), 0), levelCount() - 1);
+    float x = u * m_levels[level].width - 0.5f;
+    float y = v * m_levels[level].height - 0.5f;
+    int x0 = (int)std::floor(x), y0 = (int)std::floor(y);
+    float fx = x - x0, fy = y - y0;
+    float corners[4][4];
+    fetch(level, x0, y0, corners[0], counts);
+    fetch(level, x0 + 1, y0, corners[1], counts);
+    fetch(level, x0, y0 + 1, corners[2], counts);
+    fetch(level, x0 + 1, y0 + 1, corners[3], counts);
+    for (int c = 0; c < 4; ++c) {
+        float top = corners[0][c] + (corners[1][c] - corners[0][c]) * fx;
+        float bottom = corners[2][c] + (corners[3][c] - corners[2][c]) * fx;
+        rgba[c] = top + (bottom - top) * fy;
+    }
+}
+
+void TiledTexture::addCounts(const TileCounts& counts) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_hits += counts.hits;
+    m_misses += counts.misses;
+    m_bypassed += counts.bypassed;
+}
+
+TileStats TiledTexture::endFrame() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // Free as many tiles as the frame loaded or would have, within limits: a few in reserve for a view
+    // that starts moving, and at most half, so a thrashing frame doesn't flush the whole cache
+    long long wanted = std::min(std::max(m_loads + m_bypassed, (long long)std::max(m_maxTiles / 16, 1)),
+                                (long long)std::max(m_maxTiles / 2, 1));
+    long long available = (long long)m_free.size() + (m_maxTiles - (long long)m_tiles.size());
+    long long evictions = 0;
+    // Two laps at most: the first may only clear reference bits
+    for (size_t step = 0; available < wanted && step < 2 * m_tiles.size(); ++step) {
+        Tile* tile = m_tiles[m_hand];
+        m_hand = (m_hand + 1) % m_tiles.size();
+        if (tile->index < 0) continue;
+        if (tile->referenced.load(std::memory_order_relaxed)) {
+            tile->referenced.store(false, std::memory_order_relaxed);
+            continue;
+        }
+        m_levels[tile->level].pages[tile->index].store(NULL, std::memory_order_relaxed);
+        tile->index = -1;
+        m_free.push_back(tile);
+        available++;
+        evictions++;
+    }
+
+    int resident = (int)(m_tiles.size() - m_free.size());
+    TileStats stats = {m_hits, m_misses, m_bypassed, evictions, resident, (size_t)resident * m_tileBytes};
+    m_lastFrame = stats;
+    m_hits = 0;
+    m_misses = 0;
+    m_bypassed = 0;
+    m_loads = 0;
+    return stats;
+}
+
+TileStats TiledTexture::lastFrameStats() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_lastFrame;
+}
@@ -0,0 +1,15 @@
+#include "utils.h"
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+std::string readFile(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return "";
+    }
+    std::stringstream stream;
+    stream << file.rdbuf();
+    return stream.str();
+}